@@ -399,6 +399,57 @@ ZPPDB_DEFINE_ROW_TYPE(
     ((Integer)(alleleId))
 )
 
+/**
+ \brief Type defining rows in `alleleImmunityCoverage` table: number of hosts
+ in a population immune to an allele, written at each host sampling time.
+ */
+ZPPDB_DEFINE_ROW_TYPE(
+    AlleleImmunityCoverageRow,
+    /** Sampling time
+     */
+    ((Real)(time))
+    /**
+     Population ID
+     */
+    ((Integer)(popId))
+    /**
+     Index of the locus in a gene
+     */
+    ((Integer)(locusIndex))
+    /**
+     Allele id of the locus
+     */
+    ((Integer)(alleleId))
+    /**
+     Number of hosts immune to this allele
+     */
+    ((Integer)(hostCount))
+)
+
+/**
+ \brief Type defining rows in `alleleImmunityOverlap` table: per-population
+ summary of host allele repertoires, written at each host sampling time.
+ */
+ZPPDB_DEFINE_ROW_TYPE(
+    AlleleImmunityOverlapRow,
+    /** Sampling time
+     */
+    ((Real)(time))
+    /**
+     Population ID
+     */
+    ((Integer)(popId))
+    /**
+     Mean number of (locus, allele) pairs a host is immune to
+     */
+    ((Real)(meanImmuneAlleles))
+    /**
+     Mean number of (locus, allele) pairs shared by two hosts, over pairs of
+     hosts in neighbouring slots
+     */
+    ((Real)(meanSharedImmuneAlleles))
+)
+
 /**
  \brief Type defining rows `recordEIR` columns.
  */
@@ -1,4 +1,6 @@
 #include "DiscretizedDistribution.h"
+#include <algorithm>
+#include <cassert>
 
 //fix several bugs, change dx into vectors of dx chunks, hqx
 
@@ -13,3 +15,77 @@ double DiscretizedDistribution::draw(zppsim::rng_t & rng)
 	//return x0 + discDist(rng) + realDist(rng) * dx; original, wrong because discDist(rng) only returns 0,1,2,3...., should be timed with dx
     return x0 + pcDist(rng);
 }
+
+AliasTable::AliasTable()
+{
+}
+
+AliasTable::AliasTable(std::vector<double> const & weights) :
+	probabilities(weights.size(), 1.0),
+	aliases(weights.size())
+{
+	size_t n = weights.size();
+	double total = 0.0;
+	for(double w : weights) {
+		total += w;
+	}
+	if(total <= 0.0) {
+		for(size_t i = 0; i < n; i++) {
+			aliases[i] = i;
+		}
+		return;
+	}
+	
+	// Scale so the mean weight is 1, then pair each under-full column with
+	// an over-full one that tops it up
+	std::vector<double> scaled(n);
+	std::vector<size_t> small;
+	std::vector<size_t> large;
+	for(size_t i = 0; i < n; i++) {
+		scaled[i] = weights[i] * n / total;
+		if(scaled[i] < 1.0) {
+			small.push_back(i);
+		}
+		else {
+			large.push_back(i);
+		}
+	}
+	while(!small.empty() && !large.empty()) {
+		size_t s = small.back();
+		small.pop_back();
+		size_t l = large.back();
+		
+		probabilities[s] = scaled[s];
+		aliases[s] = l;
+		scaled[l] -= 1.0 - scaled[s];
+		if(scaled[l] < 1.0) {
+			large.pop_back();
+			small.push_back(l);
+		}
+	}
+	// Leftovers are full up to rounding error
+	for(size_t i : small) {
+		probabilities[i] = 1.0;
+		aliases[i] = i;
+	}
+	for(size_t i : large) {
+		probabilities[i] = 1.0;
+		aliases[i] = i;
+	}
+}
+
+size_t AliasTable::draw(zppsim::rng_t & rng)
+{
+	assert(probabilities.size() > 0);
+	double x = std::uniform_real_distribution<double>(0.0, double(probabilities.size()))(rng);
+	size_t i = std::min(size_t(x), probabilities.size() - 1);
+	if(x - i < probabilities[i]) {
+		return i;
+	}
+	return aliases[i];
+}
+
+size_t AliasTable::size() const
+{
+	return probabilities.size();
+}
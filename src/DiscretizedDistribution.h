@@ -16,4 +16,22 @@ private:
     double x0;
 };
 
+/**
+	\brief Alias table (Walker/Vose) for drawing an index with probability
+	proportional to fixed weights in constant time.
+	
+	All-zero weights give a uniform draw.
+*/
+class AliasTable
+{
+public:
+	AliasTable();
+	AliasTable(std::vector<double> const & weights);
+	size_t draw(zppsim::rng_t & rng);
+	size_t size() const;
+private:
+	std::vector<double> probabilities;
+	std::vector<size_t> aliases;
+};
+
 #endif // #ifndef __malariamodel__DiscretizedDistribution__
@@ -20,11 +20,13 @@ Gene::Gene(
            int64_t id, double transmissibility, double immunityLossRate, int64_t const source,
            bool functionality, std::vector<int64_t> knownAlleles,bool writeToDatabaseGene, bool writeToDatabaseLoci, Database & db, Table<GeneRow> & GeneTable,Table<LociRow> & LociTable
 ) :
-	id(id),
+	id(narrowId(id, "gene")), source(int8_t(source)),
+	functionality(functionality), recorded(writeToDatabaseGene),
 	transmissibility(transmissibility),
-	immunityLossRate(immunityLossRate), source(source),functionality(functionality),
-    Alleles(knownAlleles),recorded(writeToDatabaseGene)
+	immunityLossRate(immunityLossRate),
+    Alleles(knownAlleles)
 {
+	assert(source >= 0 && source <= std::numeric_limits<int8_t>::max());
 	if(writeToDatabaseGene) {
 		GeneRow row;
 		row.geneId = id;
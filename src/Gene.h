@@ -12,10 +12,26 @@
 #include <memory>
 #include <vector>
 #include <unordered_map>
+#include <limits>
+#include <stdexcept>
+#include <string>
 #include "zppdb.hpp"
 #include "zppsim_random.hpp"
 #include "DatabaseTypes.h"
 
+/**
+	\brief Narrows a 64-bit identifier to the 32 bits kept in memory.
+	
+	Identifiers stay 64-bit in the database; throws if `id` does not fit.
+*/
+inline int32_t narrowId(int64_t id, char const * kind)
+{
+	if(id < 0 || id > std::numeric_limits<int32_t>::max()) {
+		throw std::runtime_error(std::string(kind) + " id out of 32-bit range: " + std::to_string(id));
+	}
+	return int32_t(id);
+}
+
 class Gene;
 typedef std::shared_ptr<Gene> GenePtr;
 typedef std::weak_ptr<Gene> GenePtrW;
@@ -23,13 +39,13 @@ typedef std::weak_ptr<Gene> GenePtrW;
 class Gene
 {
 public:
-	int64_t const id;
+	int32_t const id;
+	int8_t const source;
+    bool const functionality;
+	bool recorded;
 	double const transmissibility;
 	double const immunityLossRate;
-	int64_t const source;
-    bool const functionality;
     std::vector<int64_t> Alleles;
-	bool recorded;
 	Gene(
 		int64_t id, double transmissibility, double immunityLossRate, int64_t const source,
 		    bool functionality, std::vector<int64_t> knownAlleles,bool writeToDatabaseGene, bool writeToDatabaseLoci, Database & db, Table<GeneRow> & GeneTable,Table<LociRow> & LociTable
@@ -30,14 +30,17 @@ Host::Host(
 	Database & db,
 	zppdb::Table<HostRow> & table
 ):
-	id(id), popPtr(popPtr),
+	id(narrowId(id, "host")), toTrack(false), popPtr(popPtr),
 	birthTime(birthTime), deathTime(deathTime), nextInfectionId(0),
-	deathEvent(new DeathEvent(this)),
-	immunity(this, false,popPtr->simPtr->locusNumber,popPtr->simPtr->parPtr->withinHost.infectionTimesToImmune),
-	clinicalImmunity(this, true,popPtr->simPtr->locusNumber,popPtr->simPtr->parPtr->withinHost.infectionTimesToImmune)
+	MDAEndTime(0), deferRateRefresh(false),
+	deathEvent(new DeathEvent(this))
 {
 //	cerr << "Created host " << id << ", deathTime " << deathTime << '\n';
 	
+	if(!popPtr->simPtr->lazyHostState) {
+		getImmunity();
+	}
+	
 	if(writeToDatabase) {
 		HostRow row;
 		row.hostId = id;
@@ -49,6 +52,44 @@ Host::Host(
 	addEvent(deathEvent.get());
 }
 
+// Reinitializes this host, after prepareToDie(), as a newborn with a new id,
+// so that population slots are recycled instead of reallocated; called from
+// the host's own DeathEvent, which is moved to the new death time in place
+void Host::reset(
+	int64_t newId, double newBirthTime, double newDeathTime,
+	bool writeToDatabase,
+	Database & db,
+	zppdb::Table<HostRow> & table
+)
+{
+	id = narrowId(newId, "host");
+	birthTime = newBirthTime;
+	deathTime = newDeathTime;
+	nextInfectionId = 0;
+	MDAEndTime = 0;
+	toTrack = false;
+	
+	infections.clear();
+	activeInfectionCount = 0;
+	liverStageInfectionCount = 0;
+	popPtr->updateHostIndexSets(*this);
+	if(immunity) {
+		immunity->reset();
+	}
+	clinicalImmunity.reset();
+	releaseNaiveState();
+	
+	if(writeToDatabase) {
+		HostRow row;
+		row.hostId = id;
+        row.popId = popPtr->id;
+		row.birthTime = birthTime;
+		row.deathTime = deathTime;
+		db.insert(table, row);
+	}
+	setEventTime(deathEvent.get(), deathTime);
+}
+
 double Host::getAge()
 {
 	return getTime() - birthTime;
@@ -56,13 +97,44 @@ double Host::getAge()
 
 int64_t Host::getActiveInfectionCount()
 {
-	int64_t count = 0;
+	return activeInfectionCount;
+}
+
+int64_t Host::getLiverStageInfectionCount()
+{
+	return liverStageInfectionCount;
+}
+
+int64_t Host::getInfectionCount()
+{
+	return infections.size();
+}
+
+// Recounts infections by walking the store; true if the maintained
+// counters agree
+bool Host::verifyInfectionCounts()
+{
+	int64_t nActive = 0;
+	int64_t nLiverStage = 0;
 	for(auto & infection : infections) {
 		if(infection.isActive()) {
-			count++;
+			nActive++;
+		}
+		if(infection.geneIndex == WAITING_STAGE) {
+			nLiverStage++;
 		}
 	}
-	return count;
+	return nActive == activeInfectionCount && nLiverStage == liverStageInfectionCount;
+}
+
+void Host::countInfectionRemoved(Infection & infection)
+{
+	if(infection.active) {
+		activeInfectionCount--;
+	}
+	if(infection.geneIndex == WAITING_STAGE) {
+		liverStageInfectionCount--;
+	}
 }
 
 std::vector<GenePtr> Host::getActiveInfectionGenes()
@@ -95,26 +167,27 @@ void Host::MDAClearInfection()
     bernoulli_distribution flipCoin(1-popPtr->simPtr->parPtr->MDA.strainFailRate);
     double t = getTime();
     
-    std::list<Infection>::iterator itr;
-    itr = infections.begin();
+    InfectionStore::iterator itr = infections.begin();
     while (itr != infections.end()) {
         if(flipCoin(*rngPtr)) {
             if(itr->isActive()) {
                 //if the infection is already active, give two days to be cleared
                 // add table to record duration of infection
-                popPtr->simPtr->writeDuration(itr);
+                popPtr->simPtr->writeDuration(*itr);
                 
                 // add table to record the infection for hosts being followed
-                popPtr->simPtr->writeFollowedHostInfection(itr);
+                popPtr->simPtr->writeFollowedHostInfection(*itr);
                 
                 // Remove infection
                 itr->prepareToEnd();
+                countInfectionRemoved(*itr);
                 itr = infections.erase(itr);
             }else if (popPtr->simPtr->parPtr->tLiverStage-(t-itr->initialTime)-popPtr->simPtr->parPtr->MDA.drugEffDuration <0)
                 // if the infection expresses is within the effectiveness
             {
                 // Remove infection
                 itr->prepareToEnd();
+                countInfectionRemoved(*itr);
                 itr = infections.erase(itr);
                 
             }else{
@@ -124,6 +197,8 @@ void Host::MDAClearInfection()
             ++itr;
         }
     }
+    popPtr->updateHostIndexSets(*this);
+    releaseNaiveState();
 }
 
 int64_t Host::getActiveInfectionImmunityCount()
@@ -131,7 +206,7 @@ int64_t Host::getActiveInfectionImmunityCount()
 	int64_t count = 0;
 	for(auto & infection : infections) {
 		if(infection.isActive()) {
-			if(immunity.isImmune(infection.getCurrentGene())) {
+			if(immunity && immunity->isImmune(infection.getCurrentGene())) {
 				count++;
 			}
 		}
@@ -142,9 +217,12 @@ int64_t Host::getActiveInfectionImmunityCount()
 int64_t Host::getActiveInfectionClinicalImmunityCount()
 {
 	int64_t count = 0;
+	if(!clinicalImmunity) {
+		return count;
+	}
 	for(auto & infection : infections) {
 		if(infection.isActive()) {
-			if(clinicalImmunity.isImmune(infection.getCurrentGene())) {
+			if(clinicalImmunity->isImmune(infection.getCurrentGene())) {
 				count++;
 			}
 		}
@@ -152,8 +230,47 @@ int64_t Host::getActiveInfectionClinicalImmunityCount()
 	return count;
 }
 
+ImmuneHistory & Host::getImmunity()
+{
+	if(!immunity) {
+		immunity = unique_ptr<ImmuneHistory>(new ImmuneHistory(
+			this, false, popPtr->simPtr->locusNumber,
+			popPtr->simPtr->parPtr->withinHost.infectionTimesToImmune,
+			popPtr->simPtr->lazyImmunityLoss
+		));
+	}
+	return *immunity;
+}
+
+ImmuneHistory & Host::getClinicalImmunity()
+{
+	if(!clinicalImmunity) {
+		clinicalImmunity = unique_ptr<ImmuneHistory>(new ImmuneHistory(
+			this, true, popPtr->simPtr->locusNumber,
+			popPtr->simPtr->parPtr->withinHost.infectionTimesToImmune,
+			popPtr->simPtr->lazyImmunityLoss
+		));
+	}
+	return *clinicalImmunity;
+}
+
+// With lazy host state, frees the (empty) immune histories of a host that
+// has no infections; the Host record itself keeps its fixed size
+void Host::releaseNaiveState()
+{
+	if(!popPtr->simPtr->lazyHostState || !infections.empty()) {
+		return;
+	}
+	if(immunity && immunity->isEmpty()) {
+		immunity.reset();
+	}
+	if(clinicalImmunity && clinicalImmunity->isEmpty()) {
+		clinicalImmunity.reset();
+	}
+}
+
 void Host::gainAlleleImmunity(GenePtr genePtr) {
-    immunity.gainAlleleImmunity(genePtr,false,*popPtr->simPtr->dbPtr,popPtr->simPtr->alleleImmunityTable);
+    getImmunity().gainAlleleImmunity(genePtr,false,*popPtr->simPtr->dbPtr,popPtr->simPtr->alleleImmunityTable);
 }
 
 void Host::prepareToDie()
@@ -164,10 +281,15 @@ void Host::prepareToDie()
 	for(auto & infection : infections) {
 		infection.prepareToEnd();
 	}
-	immunity.prepareToDie();
-	clinicalImmunity.prepareToDie();
+	if(immunity) {
+		immunity->prepareToDie();
+	}
+	if(clinicalImmunity) {
+		clinicalImmunity->prepareToDie();
+	}
 	
-	removeEvent(deathEvent.get());
+	// The death event stays queued: reset() re-keys it to the newborn's
+	// death time
 }
 
 double Host::moiRegulate(Host & dstHost){
@@ -180,19 +302,22 @@ double Host::moiRegulate(Host & dstHost){
 void Host::transmitTo(Host & dstHost)
 {
 	rng_t * rngPtr = getRngPtr();
+	Simulation * simPtr = popPtr->simPtr;
 	
 	if(infections.size() == 0) {
 	//	cerr << "No infections to transmit" << endl;
-        popPtr->simPtr->writeEIR(popPtr->getTime(),0);
+        simPtr->writeEIR(popPtr->getTime(),0);
 		return;
 	}
     
-    popPtr->simPtr->writeEIR(popPtr->getTime(),1);
+    simPtr->writeEIR(popPtr->getTime(),1);
     
 //	cerr << "Transmitting to " << dstHost.popPtr->id << ", " << dstHost.id << '\n';
 	double moiControl = moiRegulate(dstHost);
 	// Get some current infections according to transmission probability
-	vector<StrainPtr> originalStrains;
+	// (scratch buffers are owned by the simulation and reused across bites)
+	vector<StrainPtr> & originalStrains = simPtr->originalStrainsScratch;
+	originalStrains.clear();
     for(auto infItr = infections.begin(); infItr != infections.end(); infItr++) {
 		if(infItr->isActive()) {
 			bernoulli_distribution flipCoin(infItr->transmissionProbability()*moiControl);
@@ -207,16 +332,20 @@ void Host::transmitTo(Host & dstHost)
 		return;
 	}
 	
-	vector<StrainPtr> strainsToTransmit;
+	vector<StrainPtr> & strainsToTransmit = simPtr->transmittedStrainsScratch;
+	strainsToTransmit.clear();
 	if(originalStrains.size() > 1) {
 		// Take each original strain with probability 1.0 - pRecombinant
         // disable pRecombinant parameter, use rule of combinations
         // given n strains, the probability of strains of recombined is 1-(1/n);
 		double pRecombinant = 1.0-(1.0/double(originalStrains.size()));
 		assert(pRecombinant >= 0.0 && pRecombinant <= 1.0);
-		strainsToTransmit = drawMultipleBernoulliRandomSubset(
-			*rngPtr, originalStrains, 1.0 - pRecombinant, false
-		);
+		bernoulli_distribution keepCoin(1.0 - pRecombinant);
+		for(auto & strainPtr : originalStrains) {
+			if(keepCoin(*rngPtr)) {
+				strainsToTransmit.push_back(strainPtr);
+			}
+		}
 		
 		// Complete a set of size originalStrains.size() using recombinants
 		int64_t nRecombinants = originalStrains.size() - strainsToTransmit.size();
@@ -225,7 +354,7 @@ void Host::transmitTo(Host & dstHost)
 			int64_t ind1 = indDist(*rngPtr);
 			int64_t ind2 = indDist(*rngPtr);
 			strainsToTransmit.push_back(
-				popPtr->simPtr->recombineStrains(
+				simPtr->recombineStrains(
 					originalStrains[ind1],
 					originalStrains[ind2]
 				)
@@ -233,33 +362,37 @@ void Host::transmitTo(Host & dstHost)
 		}
 	}
 	else {
-		strainsToTransmit = originalStrains;
+		strainsToTransmit.assign(originalStrains.begin(), originalStrains.end());
 	}
 	
 	// Transmit all strains
 	for(auto & strainPtr : strainsToTransmit) {
 		dstHost.receiveInfection(strainPtr);
 	}
-	popPtr->simPtr->recordTransmission(*this, dstHost, strainsToTransmit);
+	simPtr->recordTransmission(*this, dstHost, strainsToTransmit);
 }
 
 void Host::transmitMSTo(Host & dstHost)
 {
 	rng_t * rngPtr = getRngPtr();
+	Simulation * simPtr = popPtr->simPtr;
 	
 	if(infections.size() == 0) {
         //	cerr << "No infections to transmit" << endl;
-        popPtr->simPtr->writeEIR(popPtr->getTime(),0);
+        simPtr->writeEIR(popPtr->getTime(),0);
 		return;
 	}
     
-    popPtr->simPtr->writeEIR(popPtr->getTime(),1);
+    simPtr->writeEIR(popPtr->getTime(),1);
     
     //	cerr << "Transmitting to " << dstHost.popPtr->id << ", " << dstHost.id << '\n';
 	
 	// Get some current infections according to transmission probability
-	vector<StrainPtr> originalStrains;
-    vector<GenePtr> originalMS;
+	// (scratch buffers are owned by the simulation and reused across bites)
+	vector<StrainPtr> & originalStrains = simPtr->originalStrainsScratch;
+    vector<GenePtr> & originalMS = simPtr->originalMSScratch;
+	originalStrains.clear();
+    originalMS.clear();
 	for(auto infItr = infections.begin(); infItr != infections.end(); infItr++) {
 		if(infItr->isActive()) {
 			bernoulli_distribution flipCoin(infItr->transmissionProbability());
@@ -275,24 +408,22 @@ void Host::transmitMSTo(Host & dstHost)
 		return;
 	}
 	
-	vector<StrainPtr> strainsToTransmit;
-    vector<GenePtr> msToTransmit;
+	vector<StrainPtr> & strainsToTransmit = simPtr->transmittedStrainsScratch;
+    vector<GenePtr> & msToTransmit = simPtr->transmittedMSScratch;
+	strainsToTransmit.clear();
+    msToTransmit.clear();
 	if(originalStrains.size() > 1) {
 		// Take each original strain with probability 1.0 - pRecombinant
 		//double pRecombinant = popPtr->simPtr->parPtr->pRecombinant;
         double pRecombinant = 1.0-(1.0/double(originalStrains.size()));
 		assert(pRecombinant >= 0.0 && pRecombinant <= 1.0);
-        std::vector<size_t> indices = drawMultipleBernoulli(*rngPtr, originalStrains.size(), 1.0 - pRecombinant, false);
-        strainsToTransmit.reserve(indices.size());
-        msToTransmit.reserve(indices.size());
-        for(size_t index : indices) {
-            strainsToTransmit.push_back(originalStrains[index]);
-            msToTransmit.push_back(originalMS[index]);
+        bernoulli_distribution keepCoin(1.0 - pRecombinant);
+        for(size_t index = 0; index < originalStrains.size(); index++) {
+            if(keepCoin(*rngPtr)) {
+                strainsToTransmit.push_back(originalStrains[index]);
+                msToTransmit.push_back(originalMS[index]);
+            }
         }
-        
-		//strainsToTransmit = drawMultipleBernoulliRandomSubset(
-		//	*rngPtr, originalStrains, 1.0 - pRecombinant, false
-		//);
 		
 		// Complete a set of size originalStrains.size() using recombinants
 		int64_t nRecombinants = originalStrains.size() - strainsToTransmit.size();
@@ -301,20 +432,19 @@ void Host::transmitMSTo(Host & dstHost)
 			int64_t ind1 = indDist(*rngPtr);
 			int64_t ind2 = indDist(*rngPtr);
 			strainsToTransmit.push_back(
-                    popPtr->simPtr->recombineStrains(
+                    simPtr->recombineStrains(
                     originalStrains[ind1],
                     originalStrains[ind2]
                     )
             );
             msToTransmit.push_back(
-            popPtr->simPtr->recombineMS(                                                                    originalMS[ind1],
-                originalMS[ind2])
+                simPtr->recombineMS(originalMS[ind1], originalMS[ind2])
             );
 		}
 	}
 	else {
-		strainsToTransmit = originalStrains;
-        msToTransmit = originalMS;
+		strainsToTransmit.assign(originalStrains.begin(), originalStrains.end());
+        msToTransmit.assign(originalMS.begin(), originalMS.end());
 	}
 	
 	// Transmit all strains
@@ -326,7 +456,7 @@ void Host::transmitMSTo(Host & dstHost)
      dstHost.receiveInfection(strainPtr,infItr->msPtr);
      }
      */
-	popPtr->simPtr->recordTransmission(*this, dstHost, strainsToTransmit);
+	simPtr->recordTransmission(*this, dstHost, strainsToTransmit);
 }
 
 void Host::receiveInfection(StrainPtr & strainPtr)
@@ -338,58 +468,63 @@ void Host::receiveInfection(StrainPtr & strainPtr)
 	
 	double tLiverStage = popPtr->simPtr->parPtr->tLiverStage;
 	int64_t initialGeneIndex = tLiverStage == 0 ? 0 : WAITING_STAGE;
-	infections.emplace_back(this, nextInfectionId++, strainPtr, initialGeneIndex, time);
-	
+	if(infections.empty()) {
+		infections.reserve(popPtr->simPtr->parPtr->withinHost.maxMOI);
+	}
+	InfectionHandle handle = infections.insert(
+		Infection(this, nextInfectionId++, strainPtr, initialGeneIndex, time)
+	);
 	
-	// Get an iterator to the infection so that events can
-	// point back to their infection
-	list<Infection>::reverse_iterator reverseItr = infections.rbegin();
-	reverseItr++;
-	list<Infection>::iterator infectionItr = reverseItr.base();
+	// Events refer back to their infection by handle
+	Infection * infectionPtr = &infections.get(handle);
+	if(initialGeneIndex == WAITING_STAGE) {
+		liverStageInfectionCount++;
+	}
+	popPtr->updateHostIndexSets(*this);
 	
 	// If starting in liver stage, create a fixed-time transition event
 	// (liver stage -> first gene not yet active)
 	if(initialGeneIndex == WAITING_STAGE) {
-		infectionItr->transitionEvent = unique_ptr<TransitionEvent>(
-			new TransitionEvent(infectionItr, time + tLiverStage)
+		infectionPtr->transitionEvent = unique_ptr<TransitionEvent>(
+			new TransitionEvent(this, handle, time + tLiverStage)
 		);
-		addEvent(infectionItr->transitionEvent.get());
+		addEvent(infectionPtr->transitionEvent.get());
 	}
 	// Otherwise create a rate-based transition event
 	// (first gene not yet active -> first gene active)
 	else {
-		infectionItr->transitionEvent = unique_ptr<TransitionEvent>(
+		infectionPtr->transitionEvent = unique_ptr<TransitionEvent>(
 			new TransitionEvent(
-				infectionItr,
-				infectionItr->transitionRate(),
+				this, handle,
+				infectionPtr->transitionRate(),
 				time,
 				*rngPtr
 			)
 		);
-		addEvent(infectionItr->transitionEvent.get());
+		addEvent(infectionPtr->transitionEvent.get());
 	}
 	
     //Create a mutation event, rate equals pMutation * genesPerStrain
-    infectionItr->mutationEvent = unique_ptr<MutationEvent>(new MutationEvent(infectionItr,popPtr->simPtr->parPtr->pMutation * popPtr->simPtr->parPtr->genesPerStrain * popPtr->simPtr->locusNumber,time,*rngPtr));
-    addEvent(infectionItr->mutationEvent.get());
+    infectionPtr->mutationEvent = unique_ptr<MutationEvent>(new MutationEvent(this, handle,popPtr->simPtr->parPtr->pMutation * popPtr->simPtr->parPtr->genesPerStrain * popPtr->simPtr->locusNumber,time,*rngPtr));
+    addEvent(infectionPtr->mutationEvent.get());
 
     //Create a ectopic recombination event, rate equals pIntraRecomb * C(genesPerStrain,2)
     int64_t numGenes = popPtr->simPtr->parPtr->genesPerStrain;
-    infectionItr->recombinationEvent = unique_ptr<RecombinationEvent>(new RecombinationEvent(infectionItr,popPtr->simPtr->parPtr->pIntraRecomb * numGenes * (numGenes -1)/2,time,*rngPtr));
-    addEvent(infectionItr->recombinationEvent.get());
+    infectionPtr->recombinationEvent = unique_ptr<RecombinationEvent>(new RecombinationEvent(this, handle,popPtr->simPtr->parPtr->pIntraRecomb * numGenes * (numGenes -1)/2,time,*rngPtr));
+    addEvent(infectionPtr->recombinationEvent.get());
 
 	// Create a clearance event
 	// (rate will depend on state as determined in clearanceRate()
 	// and may be zero)
-    infectionItr->clearanceEvent = unique_ptr<ClearanceEvent>(
+    infectionPtr->clearanceEvent = unique_ptr<ClearanceEvent>(
         new ClearanceEvent(
-		infectionItr, infectionItr->clearanceRate(), time, *rngPtr
+		this, handle, infectionPtr->clearanceRate(), time, *rngPtr
 		)
     );
-	addEvent(infectionItr->clearanceEvent.get());
+	addEvent(infectionPtr->clearanceEvent.get());
 
 	
-//	cerr << time << ": " << infectionItr->toString() << " begun" << '\n';
+//	cerr << time << ": " << infectionPtr->toString() << " begun" << '\n';
 }
 
 void Host::receiveInfection(StrainPtr & strainPtr, GenePtr & msPtr)
@@ -401,67 +536,77 @@ void Host::receiveInfection(StrainPtr & strainPtr, GenePtr & msPtr)
 	
 	double tLiverStage = popPtr->simPtr->parPtr->tLiverStage;
 	int64_t initialGeneIndex = tLiverStage == 0 ? 0 : WAITING_STAGE;
-	infections.emplace_back(this, nextInfectionId++, strainPtr, msPtr, initialGeneIndex, time);
-	
+	if(infections.empty()) {
+		infections.reserve(popPtr->simPtr->parPtr->withinHost.maxMOI);
+	}
+	InfectionHandle handle = infections.insert(
+		Infection(this, nextInfectionId++, strainPtr, msPtr, initialGeneIndex, time)
+	);
 	
-	// Get an iterator to the infection so that events can
-	// point back to their infection
-	list<Infection>::reverse_iterator reverseItr = infections.rbegin();
-	reverseItr++;
-	list<Infection>::iterator infectionItr = reverseItr.base();
+	// Events refer back to their infection by handle
+	Infection * infectionPtr = &infections.get(handle);
+	if(initialGeneIndex == WAITING_STAGE) {
+		liverStageInfectionCount++;
+	}
+	popPtr->updateHostIndexSets(*this);
 	
 	// If starting in liver stage, create a fixed-time transition event
 	// (liver stage -> first gene not yet active)
 	if(initialGeneIndex == WAITING_STAGE) {
-		infectionItr->transitionEvent = unique_ptr<TransitionEvent>(
-               new TransitionEvent(infectionItr, time + tLiverStage)
+		infectionPtr->transitionEvent = unique_ptr<TransitionEvent>(
+               new TransitionEvent(this, handle, time + tLiverStage)
                );
-		addEvent(infectionItr->transitionEvent.get());
+		addEvent(infectionPtr->transitionEvent.get());
 	}
 	// Otherwise create a rate-based transition event
 	// (first gene not yet active -> first gene active)
 	else {
-		infectionItr->transitionEvent = unique_ptr<TransitionEvent>(
+		infectionPtr->transitionEvent = unique_ptr<TransitionEvent>(
              new TransitionEvent(
-              infectionItr,
-              infectionItr->transitionRate(),
+              this, handle,
+              infectionPtr->transitionRate(),
               time,
               *rngPtr
               )
         );
-		addEvent(infectionItr->transitionEvent.get());
+		addEvent(infectionPtr->transitionEvent.get());
 	}
 	
     //Create a mutation event, rate equals pMutation * genesPerStrain
-    infectionItr->mutationEvent = unique_ptr<MutationEvent>(new MutationEvent(infectionItr,popPtr->simPtr->parPtr->pMutation * popPtr->simPtr->parPtr->genesPerStrain * popPtr->simPtr->locusNumber,time,*rngPtr));
-    addEvent(infectionItr->mutationEvent.get());
+    infectionPtr->mutationEvent = unique_ptr<MutationEvent>(new MutationEvent(this, handle,popPtr->simPtr->parPtr->pMutation * popPtr->simPtr->parPtr->genesPerStrain * popPtr->simPtr->locusNumber,time,*rngPtr));
+    addEvent(infectionPtr->mutationEvent.get());
     
     //Create a ectopic recombination event, rate equals pIntraRecomb * C(genesPerStrain,2)
     int64_t numGenes = popPtr->simPtr->parPtr->genesPerStrain;
-    infectionItr->recombinationEvent = unique_ptr<RecombinationEvent>(new RecombinationEvent(infectionItr,popPtr->simPtr->parPtr->pIntraRecomb * numGenes * (numGenes -1)/2,time,*rngPtr));
-    addEvent(infectionItr->recombinationEvent.get());
+    infectionPtr->recombinationEvent = unique_ptr<RecombinationEvent>(new RecombinationEvent(this, handle,popPtr->simPtr->parPtr->pIntraRecomb * numGenes * (numGenes -1)/2,time,*rngPtr));
+    addEvent(infectionPtr->recombinationEvent.get());
     
     // Create an ms mutation event, change rate
-    infectionItr->msMutationEvent = unique_ptr<MSmutationEvent>(new MSmutationEvent(infectionItr,popPtr->simPtr->parPtr->pMsMutate * popPtr->simPtr->microsatNumber,time,*rngPtr));
-    addEvent(infectionItr->msMutationEvent.get());
+    infectionPtr->msMutationEvent = unique_ptr<MSmutationEvent>(new MSmutationEvent(this, handle,popPtr->simPtr->parPtr->pMsMutate * popPtr->simPtr->microsatNumber,time,*rngPtr));
+    addEvent(infectionPtr->msMutationEvent.get());
     
     
 	// Create a clearance event
 	// (rate will depend on state as determined in clearanceRate()
 	// and may be zero)
-    infectionItr->clearanceEvent = unique_ptr<ClearanceEvent>(
+    infectionPtr->clearanceEvent = unique_ptr<ClearanceEvent>(
         new ClearanceEvent(
-        infectionItr, infectionItr->clearanceRate(), time, *rngPtr
+        this, handle, infectionPtr->clearanceRate(), time, *rngPtr
         )
     );
-	addEvent(infectionItr->clearanceEvent.get());
+	addEvent(infectionPtr->clearanceEvent.get());
     
 	
-    //	cerr << time << ": " << infectionItr->toString() << " begun" << '\n';
+    //	cerr << time << ": " << infectionPtr->toString() << " begun" << '\n';
 }
 
 void Host::updateInfectionRates()
 {
+	// Within a batched immunity update the caller refreshes once afterwards
+	if(deferRateRefresh) {
+		popPtr->simPtr->countDeferredRateRefresh(getInfectionCount() - getLiverStageInfectionCount());
+		return;
+	}
 	for(auto itr = infections.begin(); itr != infections.end(); itr++) {
 		if(itr->geneIndex != WAITING_STAGE) {
 			itr->updateClearanceRate();
@@ -470,47 +615,59 @@ void Host::updateInfectionRates()
 	}
 }
 
-void Host::clearInfection(std::list<Infection>::iterator infectionItr)
+void Host::clearInfection(InfectionHandle handle)
 {
-	assert(infectionItr != infections.end());
+	Infection * infectionPtr = &infections.get(handle);
 	
-	bool shouldUpdateAllRates = infectionItr->transitionAffectsAllInfections();
+	bool shouldUpdateAllRates = infectionPtr->transitionAffectsAllInfections();
 	
 //	double time = popPtr->getTime();
-//	cerr << time << ": " << infectionItr->toString() << " clearing" << '\n';
+//	cerr << time << ": " << infectionPtr->toString() << " clearing" << '\n';
 	
 	// Gain immunity to active gene
-	if(infectionItr->active) {
-		GenePtr genePtr = infectionItr->getCurrentGene();
+	if(infectionPtr->active) {
+		GenePtr genePtr = infectionPtr->getCurrentGene();
         
         getSelectionMode(genePtr, true);
 	}
 	
     // add table to record duration of infection
-    //double durationTime = getTime()-infectionItr->initialTime;
-    popPtr->simPtr->writeDuration(infectionItr);
+    //double durationTime = getTime()-infectionPtr->initialTime;
+    popPtr->simPtr->writeDuration(*infectionPtr);
     
     // add table to record the infection for hosts being followed
-    popPtr->simPtr->writeFollowedHostInfection(infectionItr);
+    popPtr->simPtr->writeFollowedHostInfection(*infectionPtr);
     
 	// Remove infection
-	infectionItr->prepareToEnd();
-	infections.erase(infectionItr);
+	infectionPtr->prepareToEnd();
+	countInfectionRemoved(*infectionPtr);
+	infections.erase(handle);
+	popPtr->updateHostIndexSets(*this);
 	
 	if(shouldUpdateAllRates) {
 		updateInfectionRates();
 	}
+	releaseNaiveState();
 }
 
+// Applies all immunity changes for a gene as one batch: rate refreshes
+// requested along the way are skipped, since both callers (clearInfection and
+// Infection::performTransition) refresh every infection's rates right after.
 void Host::getSelectionMode(GenePtr genePtr, bool clearInfection) {
+    deferRateRefresh = true;
+    applyImmunityUpdate(genePtr, clearInfection);
+    deferRateRefresh = false;
+}
+
+void Host::applyImmunityUpdate(GenePtr genePtr, bool clearInfection) {
     int64_t selmode = popPtr->simPtr->parPtr->selectionMode;
     //cout<<"selmode is "<<selmode<<endl;
     if (selmode == 1) {
         // specific immunity mode
         if(!popPtr->simPtr->parPtr->withinHost.useAlleleImmunity) {
-            immunity.gainImmunity(genePtr);
+            getImmunity().gainImmunity(genePtr);
             if(getSimulationParametersPtr()->trackClinicalImmunity) {
-                clinicalImmunity.gainImmunity(genePtr);
+                getClinicalImmunity().gainImmunity(genePtr);
             }
         }else{
             //cout<<"gainAlleleImmunity"<<endl;
@@ -520,33 +677,33 @@ void Host::getSelectionMode(GenePtr genePtr, bool clearInfection) {
         
     }else if ((selmode == 2) && clearInfection) {
         // general immunity mode
-        immunity.gainGeneralImmunity();
+        getImmunity().gainGeneralImmunity();
     }
     // if selmode == 3, do nothing
     
 }
 
-void Host::hstMutateStrain(std::list<Infection>::iterator infectionItr)
+void Host::hstMutateStrain(Infection & infection)
 {
-    std::vector<GenePtr> newStrainGenes = popPtr->simPtr->mutateStrain(infectionItr->strainPtr);
+    std::vector<GenePtr> newStrainGenes = popPtr->simPtr->mutateStrain(infection.strainPtr);
     std::unordered_map<size_t,size_t> reorderIndexMap = ordered(newStrainGenes);
     for (size_t i=0; i<newStrainGenes.size();i++) {
-        infectionItr->expressionOrder[i] = reorderIndexMap[infectionItr->expressionOrder[i]];
+        infection.expressionOrder[i] = reorderIndexMap[infection.expressionOrder[i]];
     }
-    infectionItr->strainPtr = popPtr->simPtr->getStrain(newStrainGenes);
+    infection.strainPtr = popPtr->simPtr->getStrain(newStrainGenes);
 }
 
-void Host::RecombineStrain(std::list<Infection>::iterator infectionItr) {
-    std::vector<GenePtr> newStrainGenes = popPtr->simPtr->ectopicRecStrain(infectionItr->strainPtr);
+void Host::RecombineStrain(Infection & infection) {
+    std::vector<GenePtr> newStrainGenes = popPtr->simPtr->ectopicRecStrain(infection.strainPtr);
     std::unordered_map<size_t,size_t> reorderIndexMap = ordered(newStrainGenes);
     for (size_t i=0; i<newStrainGenes.size();i++) {
-        infectionItr->expressionOrder[i] = reorderIndexMap[infectionItr->expressionOrder[i]];
+        infection.expressionOrder[i] = reorderIndexMap[infection.expressionOrder[i]];
     }
-    infectionItr->strainPtr = popPtr->simPtr->getStrain(newStrainGenes);
+    infection.strainPtr = popPtr->simPtr->getStrain(newStrainGenes);
 }
 
-void Host::microsatMutate(std::list<Infection>::iterator infectionItr) {
-    infectionItr->msPtr = popPtr->simPtr->mutateMS(infectionItr->msPtr);
+void Host::microsatMutate(Infection & infection) {
+    infection.msPtr = popPtr->simPtr->mutateMS(infection.msPtr);
 }
 
 double Host::getTime()
@@ -569,6 +726,11 @@ PopulationParameters * Host::getPopulationParametersPtr()
 	return popPtr->parPtr;
 }
 
+WithinHostRates * Host::getWithinHostRatesPtr()
+{
+	return &popPtr->simPtr->withinHostRates;
+}
+
 void Host::addEvent(Event * event)
 {
 	popPtr->addEvent(event);
@@ -579,6 +741,11 @@ void Host::removeEvent(Event * event)
 	popPtr->removeEvent(event);
 }
 
+void Host::setEventTime(Event * event, double time)
+{
+	popPtr->setEventTime(event, time);
+}
+
 void Host::setEventRate(RateEvent * event, double rate)
 {
 	popPtr->setEventRate(event, rate);
@@ -611,8 +778,18 @@ DeathEvent::DeathEvent(Host * hostPtr):
 {
 }
 
+void * DeathEvent::operator new(size_t size)
+{
+	return ObjectPool<sizeof(DeathEvent)>::allocate(size);
+}
+
+void DeathEvent::operator delete(void * ptr, size_t size)
+{
+	ObjectPool<sizeof(DeathEvent)>::release(ptr, size);
+}
+
 void DeathEvent::performEvent(zppsim::EventQueue & queue)
 {
 	hostPtr->prepareToDie();
-	hostPtr->popPtr->removeHost(hostPtr);
+	hostPtr->popPtr->replaceHost(hostPtr);
 }
@@ -2,7 +2,6 @@
 #define __malariamodel__Host__
 
 #include <unordered_set>
-#include <list>
 #include "EventQueue.hpp"
 #include "Strain.h"
 #include "Gene.h"
@@ -13,7 +12,8 @@
 #include "zppdb.hpp"
 #include "DatabaseTypes.h"
 
-#define WAITING_STAGE (std::numeric_limits<int64_t>::max())
+// Gene index of an infection still in the liver stage
+#define WAITING_STAGE (std::numeric_limits<int16_t>::max())
 
 class Host;
 class Population;
@@ -25,6 +25,9 @@ public:
 	DeathEvent(Host * hostPtr);
 	virtual void performEvent(zppsim::EventQueue & queue);
 	
+	static void * operator new(size_t size);
+	static void operator delete(void * ptr, size_t size);
+	
 	Host * hostPtr;
 };
 
@@ -35,9 +38,10 @@ friend class Simulation;
 friend class Population;
 friend class DeathEvent;
 friend class Infection;
+friend class InfectionProcessEvent;
 friend class ImmuneHistory;
 public:
-	int64_t const id;
+	int32_t id;
 	
 	Host(
 		Population * popPtr, int64_t id, double birthTime, double deathTime,
@@ -47,9 +51,16 @@ public:
 	);
 	
     //whether to track this hosts' entire infection histroy
-    bool toTrack = false;
+    bool toTrack : 1;
     
 	void prepareToDie();
+	void releaseNaiveState();
+	void reset(
+		int64_t id, double birthTime, double deathTime,
+		bool writeToDatabase,
+		Database & db,
+		zppdb::Table<HostRow> & table
+	);
     
     double moiRegulate(Host & dstHost);
 	
@@ -66,6 +77,9 @@ public:
 	double getAge();
 	
 	int64_t getActiveInfectionCount();
+	int64_t getLiverStageInfectionCount();
+	int64_t getInfectionCount();
+	bool verifyInfectionCounts();
 	std::vector<GenePtr> getActiveInfectionGenes();
 	std::vector<int64_t> getActiveInfectionGeneIds();
     
@@ -75,21 +89,24 @@ public:
 	int64_t getActiveInfectionClinicalImmunityCount();
 	
     void gainAlleleImmunity(GenePtr genePtr);
-	void clearInfection(std::list<Infection>::iterator infectionItr);
-    void hstMutateStrain(std::list<Infection>::iterator infectionItr);
-    void RecombineStrain(std::list<Infection>::iterator infectionItr);
+	void clearInfection(InfectionHandle handle);
+    void hstMutateStrain(Infection & infection);
+    void RecombineStrain(Infection & infection);
     
     void getSelectionMode(GenePtr genePtr, bool clearInfection);
-	void microsatMutate(std::list<Infection>::iterator infectionItr);
+    void applyImmunityUpdate(GenePtr genePtr, bool clearInfection);
+	void microsatMutate(Infection & infection);
     
 	double getTime();
 	zppsim::rng_t * getRngPtr();
 	  
 	SimParameters * getSimulationParametersPtr();
 	PopulationParameters * getPopulationParametersPtr();
+	WithinHostRates * getWithinHostRatesPtr();
 	
 	void addEvent(zppsim::Event * event);
 	void removeEvent(zppsim::Event * event);
+	void setEventTime(zppsim::Event * event, double time);
 	void setEventRate(zppsim::RateEvent * event, double rate);
 	
 	void writeInfections(Database & db, Table<InfectionRow> & table, Table<StrainRow> & strainsTable,Table<GeneRow> & GeneTable,Table<LociRow> & LociTable);
@@ -98,21 +115,41 @@ public:
 	std::string toString();
 private:
 	Population * popPtr;
-	double const birthTime;
-	double const deathTime;
+	double birthTime;
+	double deathTime;
 	
-	int64_t nextInfectionId;
+	int32_t nextInfectionId;
 	
-    double MDAEndTime = 0;
+    // day resolution is enough for the end of drug protection
+    float MDAEndTime;
     
-	// Linked list of current infections
-	std::list<Infection> infections;
+    // set while getSelectionMode applies a batch of immunity changes
+    bool deferRateRefresh : 1;
+    
+	// Current infections
+	InfectionStore infections;
+	
+	// Maintained as infections are received, transition and end
+	// (checked against a recount by verifyInfectionCounts)
+	int32_t activeInfectionCount = 0;
+	int32_t liverStageInfectionCount = 0;
+	void countInfectionRemoved(Infection & infection);
+	
+	// Positions in the population's infected/active host index sets
+	// (-1 if not a member); kept in sync by Population::updateHostIndexSets
+	int32_t infectedSetPos = -1;
+	int32_t activeSetPos = -1;
 	
 	std::unique_ptr<DeathEvent> deathEvent;
 	
-	// Two sets of immune history (regular & "clinical")
-	ImmuneHistory immunity;
-	ImmuneHistory clinicalImmunity;
+	// Two sets of immune history (regular & "clinical");
+	// clinical immunity is only allocated once it is first gained, and
+	// regular immunity too when hosts are materialized lazily
+	std::unique_ptr<ImmuneHistory> immunity;
+	std::unique_ptr<ImmuneHistory> clinicalImmunity;
+	
+	ImmuneHistory & getImmunity();
+	ImmuneHistory & getClinicalImmunity();
 };
 
 #endif
@@ -10,6 +10,8 @@
 
 #include "ImmuneHistory.h"
 #include "Host.h"
+#include "Simulation.h"
+#include <algorithm>
 
 using namespace std;
 using namespace zppsim;
@@ -26,26 +28,52 @@ ImmunityLossEvent::ImmunityLossEvent(ImmuneHistory * immHistPtr, GenePtr genePtr
 
 void ImmunityLossEvent::performEvent(zppsim::EventQueue & queue)
 {
+	// this event is destroyed by loseImmunity
+	Host * hostPtr = immHistPtr->hostPtr;
 	immHistPtr->loseImmunity(genePtr);
+	hostPtr->releaseNaiveState();
+}
+
+void * ImmunityLossEvent::operator new(size_t size)
+{
+	return ObjectPool<sizeof(ImmunityLossEvent)>::allocate(size);
+}
+
+void ImmunityLossEvent::operator delete(void * ptr, size_t size)
+{
+	ObjectPool<sizeof(ImmunityLossEvent)>::release(ptr, size);
 }
 
 /*** AlleleImmuneLossEvent function implementations ***/
 
-AlleleImmuneLossEvent::AlleleImmuneLossEvent(ImmuneHistory * immHistPtr, int64_t & locusId, int64_t & AlleleId,
+AlleleImmuneLossEvent::AlleleImmuneLossEvent(ImmuneHistory * immHistPtr, AlleleKey key,
                                      double rate, double initTime) :
 RateEvent(rate, initTime, *immHistPtr->hostPtr->getRngPtr()),
-immHistPtr(immHistPtr), locusId(locusId),AlleleId(AlleleId)
+immHistPtr(immHistPtr), key(key)
 {
 }
 
 void AlleleImmuneLossEvent::performEvent(zppsim::EventQueue & queue)
 {
-	immHistPtr->loseAlleleImmune(locusId,AlleleId);
+	// this event is destroyed by loseAlleleImmune
+	Host * hostPtr = immHistPtr->hostPtr;
+	immHistPtr->loseAlleleImmune(key);
+	hostPtr->releaseNaiveState();
+}
+
+void * AlleleImmuneLossEvent::operator new(size_t size)
+{
+	return ObjectPool<sizeof(AlleleImmuneLossEvent)>::allocate(size);
+}
+
+void AlleleImmuneLossEvent::operator delete(void * ptr, size_t size)
+{
+	ObjectPool<sizeof(AlleleImmuneLossEvent)>::release(ptr, size);
 }
 
 /*** ImmuneHistory function implementations ***/
 
-ImmuneHistory::ImmuneHistory(Host * hostPtr, bool clinical, int64_t const locusNumber, double infectionTimesToImmune) : hostPtr(hostPtr), clinical(clinical),locusNumber(locusNumber), infectionTimesToImmune(infectionTimesToImmune)
+ImmuneHistory::ImmuneHistory(Host * hostPtr, bool clinical, int64_t const locusNumber, double infectionTimesToImmune, bool lazyAlleleLoss) : hostPtr(hostPtr), clinical(clinical),locusNumber(locusNumber), infectionTimesToImmune(infectionTimesToImmune), lazyAlleleLoss(lazyAlleleLoss)
 {
 }
 
@@ -92,85 +120,190 @@ double ImmuneHistory::checkGeneralImmunity(std::vector<double> params, double &
     }
 }
 
-int64_t ImmuneHistory::geneLocToHash(int64_t locusId, int64_t AlleleId) {
-    int64_t a = AlleleId*100;
-    a += locusId;
-    //cout<<"geneHashVal "<<a<<endl;
-    return (a);
+int64_t ImmuneHistory::getInfectedTimes() {
+    return infectedTimes;
 }
 
-
 void ImmuneHistory::gainAlleleImmunity(GenePtr genePtr,bool writeToDatabase,Database & db,zppdb::Table<AlleleImmunityRow> & table)
 {
     double immunityLossRate = genePtr->immunityLossRate;
-    vector<int64_t> geneAlleles = genePtr->Alleles;
-    if(immuneAlleles.empty()) { //construct a list with immuned alleles
-        for (int64_t i=0; i<locusNumber;i++) {
-            std::unordered_map<int64_t,int64_t> tempMap({{geneAlleles[i],1}});
-            immuneAlleles.push_back(tempMap);
-            //set Allele loss event for each allele
-            //rate inverse proportional to infected times
-            setAlleleLossEvent(i,geneAlleles[i],immunityLossRate);
-            //cout<<"addImmunity at locus "<<i<<" of allele "<<geneAlleles[i]<<endl;
+    vector<int64_t> const & geneAlleles = genePtr->Alleles;
+    double t = hostPtr->getTime();
+    bool firstGain = !gainedAlleleImmunity;
+    gainedAlleleImmunity = true;
+    for (int64_t i=0; i<locusNumber;i++) {
+        AlleleKey key(i, geneAlleles[i]);
+        auto it = immuneAlleles.find(key);
+        if(it != immuneAlleles.end() && lazyAlleleLoss && it->second.lossTime <= t) {
+            // immunity already expired but not yet swept
+            countAlleleImmunity(key, -1);
+            immuneAlleles.erase(it);
+            it = immuneAlleles.end();
         }
-    }else{
-        for (int64_t i=0; i<locusNumber;i++) {
-            if(immuneAlleles[i].find(geneAlleles[i])==immuneAlleles[i].end()) {
-                immuneAlleles[i][geneAlleles[i]] = 1;
-                //cout<<"addImmunity at locus "<<i<<" of allele "<<geneAlleles[i]<<endl;
-                if(writeToDatabase) {
-                    AlleleImmunityRow row;
-                    row.time = hostPtr->getTime();
-                    row.hostId = hostPtr->id;
-                    row.locusIndex = i;
-                    row.alleleId = geneAlleles[i];
-                    db.insert(table, row);
-                }
-                setAlleleLossEvent(i,geneAlleles[i],immunityLossRate);
-                
-            }else{
-                immuneAlleles[i][geneAlleles[i]] ++;
-                updateAlleleLossRate(i, geneAlleles[i],immunityLossRate/immuneAlleles[i][geneAlleles[i]]);
+        if(it == immuneAlleles.end()) {
+            AlleleImmunity & entry = immuneAlleles[key];
+            entry.count = 1;
+            entry.lossTime = std::numeric_limits<double>::infinity();
+            countAlleleImmunity(key, 1);
+            //cout<<"addImmunity at locus "<<i<<" of allele "<<geneAlleles[i]<<endl;
+            if(writeToDatabase && !firstGain) {
+                AlleleImmunityRow row;
+                row.time = t;
+                row.hostId = hostPtr->id;
+                row.locusIndex = key.locusId();
+                row.alleleId = key.alleleId();
+                db.insert(table, row);
             }
+            //set Allele loss event for each allele
+            //rate inverse proportional to infected times
+            setAlleleLossEvent(entry, key, immunityLossRate);
+        }else{
+            it->second.count ++;
+            updateAlleleLossRate(it->second, immunityLossRate/it->second.count);
         }
     }
+    immuneEpoch++;
     //hostPtr->updateInfectionRates();
     
 }
 
-void ImmuneHistory::setAlleleLossEvent(int64_t locusId, int64_t AlleleId,double lossrate) {
-    double geneLocHashValue = geneLocToHash(locusId, AlleleId);
-    assert(alleleLossEvents.find(geneLocHashValue) == alleleLossEvents.end());
-    AlleleImmuneLossEvent * ilEvent = new AlleleImmuneLossEvent(
-                                                        this, locusId, AlleleId,lossrate, hostPtr->getTime());
-    alleleLossEvents[geneLocHashValue] = unique_ptr<AlleleImmuneLossEvent>(ilEvent);
-    hostPtr->addEvent(ilEvent);
+// bookkeeping whenever an allele entry is added (+1) or removed (-1)
+void ImmuneHistory::countAlleleImmunity(AlleleKey key, int64_t delta) {
+    // only regular (not clinical) immunity counts toward population coverage
+    if(!clinical) {
+        hostPtr->popPtr->updateAlleleImmunityCount(key, delta);
+    }
     
+    AlleleBitLayout * layoutPtr = getBitLayoutPtr();
+    if(layoutPtr != NULL) {
+        if(immuneAlleleBits.empty()) {
+            immuneAlleleBits.resize(layoutPtr->wordCount, 0);
+        }
+        int64_t alleleId = key.alleleId();
+        uint64_t & word = immuneAlleleBits[layoutPtr->wordOffsets[key.locusId()] + alleleId / 64];
+        uint64_t bit = uint64_t(1) << (alleleId % 64);
+        if(delta > 0) {
+            word |= bit;
+        }
+        else {
+            word &= ~bit;
+        }
+    }
 }
 
-void ImmuneHistory::updateAlleleLossRate(int64_t & locusId, int64_t & AlleleId,double newRate) {
-    auto itr2 = alleleLossEvents.find(geneLocToHash(locusId,AlleleId));
-    assert(itr2 != alleleLossEvents.end());
-    hostPtr->setEventRate(itr2->second.get(), newRate);
+AlleleBitLayout * ImmuneHistory::getBitLayoutPtr() {
+    AlleleBitLayout * layoutPtr = &hostPtr->popPtr->simPtr->alleleBitLayout;
+    return layoutPtr->active ? layoutPtr : NULL;
+}
+
+bool ImmuneHistory::testAlleleBit(AlleleBitLayout * layoutPtr, AlleleKey key) {
+    if(immuneAlleleBits.empty()) {
+        return false;
+    }
+    int64_t alleleId = key.alleleId();
+    uint64_t word = immuneAlleleBits[layoutPtr->wordOffsets[key.locusId()] + alleleId / 64];
+    return (word >> (alleleId % 64)) & 1;
+}
+
+double ImmuneHistory::drawAlleleLossTime(double lossRate) {
+    if(lossRate <= 0.0) {
+        return std::numeric_limits<double>::infinity();
+    }
+    return hostPtr->getTime() + exponential_distribution<>(lossRate)(*hostPtr->getRngPtr());
+}
+
+void ImmuneHistory::setAlleleLossEvent(AlleleImmunity & entry, AlleleKey key, double lossrate) {
+    if(lazyAlleleLoss) {
+        entry.lossTime = drawAlleleLossTime(lossrate);
+        return;
+    }
+    assert(!entry.lossEvent);
+    entry.lossEvent = unique_ptr<AlleleImmuneLossEvent>(
+        new AlleleImmuneLossEvent(this, key, lossrate, hostPtr->getTime())
+    );
+    hostPtr->addEvent(entry.lossEvent.get());
+    
+}
+
+void ImmuneHistory::updateAlleleLossRate(AlleleImmunity & entry, double newRate) {
+    if(lazyAlleleLoss) {
+        // loss is memoryless, so redrawing at the new rate is equivalent
+        // to rescaling the pending loss event
+        entry.lossTime = drawAlleleLossTime(newRate);
+        return;
+    }
+    assert(entry.lossEvent);
+    hostPtr->setEventRate(entry.lossEvent.get(), newRate);
 }
 
 double ImmuneHistory::checkGeneImmunity(GenePtr genePtr) {
-    vector<int64_t> geneAlleles = genePtr->Alleles;
+    double t = hostPtr->getTime();
+    if(cacheEpoch == immuneEpoch && t < cacheValidUntil) {
+        auto cached = geneImmunityCache.find(genePtr->id);
+        if(cached != geneImmunityCache.end()) {
+            return cached->second;
+        }
+    }
+    else {
+        geneImmunityCache.clear();
+        cacheEpoch = immuneEpoch;
+        cacheValidUntil = std::numeric_limits<double>::infinity();
+    }
+    
+    double validUntil;
+    double immuneFraction = computeGeneImmunity(genePtr, validUntil);
+    
+    // computing may have dropped expired entries and started a new epoch
+    if(cacheEpoch != immuneEpoch) {
+        geneImmunityCache.clear();
+        cacheEpoch = immuneEpoch;
+        cacheValidUntil = std::numeric_limits<double>::infinity();
+    }
+    cacheValidUntil = std::min(cacheValidUntil, validUntil);
+    geneImmunityCache[genePtr->id] = immuneFraction;
+    return immuneFraction;
+}
+
+double ImmuneHistory::computeGeneImmunity(GenePtr const & genePtr, double & validUntil) {
+    vector<int64_t> const & geneAlleles = genePtr->Alleles;
     double immuneLevel = 0;
     double immuneTime = 1.0;
-    std::unordered_map<int64_t,int64_t>::iterator it;
+    double t = hostPtr->getTime();
+    validUntil = std::numeric_limits<double>::infinity();
+    AlleleBitLayout * layoutPtr = getBitLayoutPtr();
     if(immuneAlleles.empty()) {
         return 0;
     }else{
         for (int64_t i=0; i<locusNumber;i++) {
-            it = immuneAlleles[i].find(geneAlleles[i]);
-            if(it != immuneAlleles[i].end()) {
-                if (it->second<=immuneTime) {
-                    immuneLevel += 1/immuneTime*(it->second);
+            AlleleKey key(i, geneAlleles[i]);
+            if(layoutPtr != NULL) {
+                // bitset answers membership; every stored count is >= 1,
+                // i.e. fully immune, so only lazy expiry needs the hash entry
+                assert(immuneTime <= 1.0);
+                if(!testAlleleBit(layoutPtr, key)) {
+                    continue;
+                }
+                if(!lazyAlleleLoss) {
+                    immuneLevel += 1;
+                    continue;
+                }
+            }
+            auto it = immuneAlleles.find(key);
+            if(it != immuneAlleles.end()) {
+                if(lazyAlleleLoss && it->second.lossTime <= t) {
+                    countAlleleImmunity(it->first, -1);
+                    immuneAlleles.erase(it);
+                    immuneEpoch++;
+                    continue;
+                }
+                validUntil = std::min(validUntil, it->second.lossTime);
+                if (it->second.count<=immuneTime) {
+                    immuneLevel += 1/immuneTime*(it->second.count);
                 }else{
                     immuneLevel += 1;
                 }
-            }        }
+            }
+        }
         double immuneFraction = immuneLevel/(double)locusNumber;
         //cout<<immuneFraction<<endl;
         return immuneFraction;
@@ -195,20 +328,17 @@ void ImmuneHistory::loseImmunity(GenePtr genePtr)
 }
 
 
-void ImmuneHistory::loseAlleleImmune(int64_t & locusId,int64_t & AlleleId)
+void ImmuneHistory::loseAlleleImmune(AlleleKey key)
 {
-    //cout<<locusId<<":"<<AlleleId<<endl;
-	// Remove allele immunity
-	auto itr1 = immuneAlleles[locusId].find(AlleleId);
-	assert(itr1 != immuneAlleles[locusId].end());
-	immuneAlleles[locusId].erase(itr1);
-	
-	// Remove immunity loss event
-	auto itr2 = alleleLossEvents.find(geneLocToHash(locusId,AlleleId));
-	assert(itr2 != alleleLossEvents.end());
-	AlleleImmuneLossEvent * ilEvent = itr2->second.get();
-	hostPtr->removeEvent(ilEvent);
-	alleleLossEvents.erase(itr2);
+    //cout<<key.locusId()<<":"<<key.alleleId()<<endl;
+	// Remove allele immunity and its loss event
+	auto itr = immuneAlleles.find(key);
+	assert(itr != immuneAlleles.end());
+	assert(itr->second.lossEvent);
+	hostPtr->removeEvent(itr->second.lossEvent.get());
+	countAlleleImmunity(key, -1);
+	immuneAlleles.erase(itr);
+	immuneEpoch++;
 	hostPtr->updateInfectionRates();
 }
 
@@ -218,17 +348,137 @@ bool ImmuneHistory::isImmune(GenePtr genePtr)
 	return genes.find(genePtr) != genes.end();
 }
 
+void ImmuneHistory::expireAlleles()
+{
+    if(!lazyAlleleLoss) {
+        return;
+    }
+    double t = hostPtr->getTime();
+    bool lost = false;
+    for(auto itr = immuneAlleles.begin(); itr != immuneAlleles.end(); ) {
+        if(itr->second.lossTime <= t) {
+            countAlleleImmunity(itr->first, -1);
+            itr = immuneAlleles.erase(itr);
+            lost = true;
+        }
+        else {
+            ++itr;
+        }
+    }
+    if(lost) {
+        immuneEpoch++;
+        hostPtr->updateInfectionRates();
+    }
+}
+
+// Bounds memory of long-lived hosts: drops expired entries and rebuilds hash
+// tables whose bucket arrays have outgrown their contents (rebuilding also
+// reallocates the surviving nodes together). Loss events are owned through
+// unique_ptr, so moving entries leaves queued events untouched.
+void ImmuneHistory::compact()
+{
+    expireAlleles();
+    
+    size_t minBuckets = size_t(immuneAlleles.size() / immuneAlleles.max_load_factor()) + 1;
+    if(immuneAlleles.bucket_count() > 2 * minBuckets + 8) {
+        std::unordered_map<AlleleKey, AlleleImmunity, HashAlleleKey> compacted(minBuckets);
+        for(auto & kv : immuneAlleles) {
+            compacted.emplace(kv.first, std::move(kv.second));
+        }
+        immuneAlleles.swap(compacted);
+    }
+    if(immuneAlleles.empty() && !immuneAlleleBits.empty()) {
+        std::vector<uint64_t>().swap(immuneAlleleBits);
+    }
+    
+    genes.rehash(0);
+    lossEvents.rehash(0);
+    
+    geneImmunityCache.clear();
+    geneImmunityCache.rehash(0);
+}
+
+static inline int64_t popcount64(uint64_t x)
+{
+#if defined(__GNUC__) || defined(__clang__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return int64_t((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+int64_t ImmuneHistory::immuneAlleleCount()
+{
+    if(getBitLayoutPtr() == NULL) {
+        return immuneAlleles.size();
+    }
+    int64_t count = 0;
+    for(uint64_t word : immuneAlleleBits) {
+        count += popcount64(word);
+    }
+    return count;
+}
+
+// number of (locus, allele) pairs both hosts are immune to
+int64_t ImmuneHistory::sharedImmuneAlleleCount(ImmuneHistory & other)
+{
+    if(getBitLayoutPtr() == NULL) {
+        int64_t count = 0;
+        for(auto & kv : immuneAlleles) {
+            if(other.immuneAlleles.find(kv.first) != other.immuneAlleles.end()) {
+                count++;
+            }
+        }
+        return count;
+    }
+    if(immuneAlleleBits.empty() || other.immuneAlleleBits.empty()) {
+        return 0;
+    }
+    int64_t count = 0;
+    for(size_t i = 0; i < immuneAlleleBits.size(); i++) {
+        count += popcount64(immuneAlleleBits[i] & other.immuneAlleleBits[i]);
+    }
+    return count;
+}
+
 void ImmuneHistory::prepareToDie()
 {
 	for(auto itr = lossEvents.begin(); itr != lossEvents.end(); itr++) {
 		hostPtr->removeEvent(itr->second.get());
 	}
-	for(auto itr = alleleLossEvents.begin(); itr != alleleLossEvents.end(); itr++) {
-		hostPtr->removeEvent(itr->second.get());
+	for(auto itr = immuneAlleles.begin(); itr != immuneAlleles.end(); itr++) {
+		if(itr->second.lossEvent) {
+			hostPtr->removeEvent(itr->second.lossEvent.get());
+		}
+		countAlleleImmunity(itr->first, -1);
 	}
     
 }
 
+// True if there is nothing to remember: no immune genes or alleles and no
+// past infections (general immunity)
+bool ImmuneHistory::isEmpty()
+{
+	return genes.empty() && immuneAlleles.empty() && infectedTimes == 0 && !gainedAlleleImmunity;
+}
+
+// Clears all immune state after prepareToDie() so the history can be reused
+// by a newborn host; container storage is kept
+void ImmuneHistory::reset()
+{
+	immuneAlleles.clear();
+	genes.clear();
+	lossEvents.clear();
+	immuneAlleleBits.clear();
+	infectedTimes = 0;
+	gainedAlleleImmunity = false;
+	immuneEpoch++;
+	geneImmunityCache.clear();
+}
+
 void ImmuneHistory::write(Database & db, Table<ImmunityRow> & table)
 {
 	ImmunityRow row;
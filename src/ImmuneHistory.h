@@ -15,7 +15,13 @@
 #include "zppsim_util.hpp"
 #include <unordered_map>
 #include <unordered_set>
+#include <memory>
+#include <cassert>
+#include <limits>
+#include <stdexcept>
+#include <string>
 #include "Gene.h"
+#include "ObjectPool.h"
 
 class Host;
 class ImmuneHistory;
@@ -25,59 +31,194 @@ class ImmunityLossEvent : public zppsim::RateEvent
 public:
 	ImmunityLossEvent(ImmuneHistory * immHistPtr, GenePtr genePtr, double rate, double initTime);
 	virtual void performEvent(zppsim::EventQueue & queue);
+	
+	static void * operator new(size_t size);
+	static void operator delete(void * ptr, size_t size);
 private:
 	ImmuneHistory * immHistPtr;
 	GenePtr genePtr;
 };
 
 
+/**
+	\brief Packed (locus, allele) identifier used to key allele immunity.
+	
+	The locus index occupies the high 24 bits and the allele id the low 40
+	bits, so keys stay unique for up to 2^24 loci and 2^40 alleles per locus;
+	throws if either field is out of range.
+*/
+class AlleleKey
+{
+public:
+	AlleleKey() : packed(0) {}
+	AlleleKey(int64_t locusId, int64_t alleleId) :
+		packed(pack(locusId, alleleId))
+	{
+	}
+	
+	// Whether a (locus, allele) pair can be packed without loss
+	static bool fits(int64_t locusId, int64_t alleleId)
+	{
+		return locusId >= 0 && locusId < (int64_t(1) << LOCUS_BITS)
+			&& alleleId >= 0 && alleleId < (int64_t(1) << ALLELE_BITS);
+	}
+	
+	static uint64_t pack(int64_t locusId, int64_t alleleId)
+	{
+		if(!fits(locusId, alleleId)) {
+			throw std::runtime_error(
+				"allele key out of range: locus " + std::to_string(locusId)
+				+ ", allele " + std::to_string(alleleId)
+			);
+		}
+		return (uint64_t(locusId) << ALLELE_BITS) | uint64_t(alleleId);
+	}
+	
+	int64_t locusId() const { return int64_t(packed >> ALLELE_BITS); }
+	int64_t alleleId() const { return int64_t(packed & ALLELE_MASK); }
+	
+	bool operator==(AlleleKey const & other) const { return packed == other.packed; }
+	bool operator!=(AlleleKey const & other) const { return packed != other.packed; }
+	
+	uint64_t packed;
+	
+	static int const LOCUS_BITS = 24;
+	static int const ALLELE_BITS = 40;
+	static uint64_t const ALLELE_MASK = (uint64_t(1) << ALLELE_BITS) - 1;
+};
+
+/**
+	\brief Hash for AlleleKey.
+	
+	Keys are dense in the low (allele) bits and nearly constant in the high
+	(locus) bits, so bits are mixed (64-bit finalizer from MurmurHash3)
+	before bucketing.
+*/
+class HashAlleleKey
+{
+public:
+	size_t operator()(AlleleKey const & key) const
+	{
+		uint64_t h = key.packed;
+		h ^= h >> 33;
+		h *= 0xff51afd7ed558ccdULL;
+		h ^= h >> 33;
+		h *= 0xc4ceb9fe1a85ec53ULL;
+		h ^= h >> 33;
+		return size_t(h);
+	}
+};
+
 class AlleleImmuneLossEvent : public zppsim::RateEvent
 {
 public:
-	AlleleImmuneLossEvent(ImmuneHistory * immHistPtr, int64_t & locusId, int64_t & AlleleId, double rate, double initTime);
+	AlleleImmuneLossEvent(ImmuneHistory * immHistPtr, AlleleKey key, double rate, double initTime);
 	virtual void performEvent(zppsim::EventQueue & queue);
+	
+	static void * operator new(size_t size);
+	static void operator delete(void * ptr, size_t size);
 private:
 	ImmuneHistory * immHistPtr;
-	int64_t locusId;
-    int64_t AlleleId;
+	AlleleKey key;
 };
 
 
+/**
+	\brief Immunity to a single allele at a locus.
+	
+	`lossEvent` is the pending AlleleImmuneLossEvent for this allele.
+	When immunity loss is applied lazily (`useLazyImmunityLoss`) there is no
+	loss event and `lossTime` holds the drawn loss time instead.
+*/
+struct AlleleImmunity
+{
+	int64_t count;
+	double lossTime;
+	std::unique_ptr<AlleleImmuneLossEvent> lossEvent;
+};
+
+/**
+	\brief Layout of per-host allele immunity bitsets, shared by all hosts.
+	
+	Used when the allele space is bounded (`useAlleleBitsets` and no source of
+	new alleles). Locus `i` occupies `alleleCapacity[i]` bits starting at word
+	`wordOffsets[i]`. If new alleles appear anyway, `active` is cleared and
+	hosts fall back to the hash store for good.
+*/
+struct AlleleBitLayout
+{
+	bool active = false;
+	std::vector<int64_t> alleleCapacity;
+	std::vector<size_t> wordOffsets;
+	size_t wordCount = 0;
+};
+
 class ImmuneHistory
 {
+friend class Simulation;
 friend class ImmunityLossEvent;
 friend class AlleleImmuneLossEvent;
 public:
-	ImmuneHistory(Host * hostPtr, bool clinical, int64_t const locusNumber, double infectionTimesToImmune);
+	ImmuneHistory(Host * hostPtr, bool clinical, int64_t const locusNumber, double infectionTimesToImmune, bool lazyAlleleLoss);
 	
 	void gainImmunity(GenePtr genePtr);
 	void gainAlleleImmunity(GenePtr genePtr, bool writeToDatabase,Database & db,zppdb::Table<AlleleImmunityRow> & table);
-    void setAlleleLossEvent(int64_t locusId, int64_t AlleleId,double lossrate);
+    void setAlleleLossEvent(AlleleImmunity & entry, AlleleKey key, double lossrate);
     double checkGeneImmunity(GenePtr genePtr);
 	void gainGeneralImmunity();
     double checkGeneralImmunity(double a, double b);
     double checkGeneralImmunity(std::vector<double> params, double & immuneRate);
+    int64_t getInfectedTimes();
     void loseImmunity(GenePtr genePtr);
-    void loseAlleleImmune(int64_t & locusId,int64_t & AlleleId);
+    void loseAlleleImmune(AlleleKey key);
 	bool isImmune(GenePtr genePtr);
+    void expireAlleles();
+    void compact();
+    int64_t immuneAlleleCount();
+    int64_t sharedImmuneAlleleCount(ImmuneHistory & other);
 	
 	void prepareToDie();
+	void reset();
+	bool isEmpty();
 	
 	void write(Database & db, Table<ImmunityRow> & table);
 	void write(int64_t transmissionId, Database & db, Table<TransmissionImmunityRow> & table);
 	
-    std::vector<std::unordered_map<int64_t,int64_t>> immuneAlleles;
+    std::unordered_map<AlleleKey, AlleleImmunity, HashAlleleKey> immuneAlleles;
 	std::unordered_set<GenePtr> genes;
 	std::unordered_map<GenePtr, std::unique_ptr<ImmunityLossEvent>> lossEvents;
-    int64_t geneLocToHash(int64_t locusId, int64_t AlleleId);
-	std::unordered_map<int64_t, std::unique_ptr<AlleleImmuneLossEvent>> alleleLossEvents;
-    void updateAlleleLossRate(int64_t &  locusId, int64_t &  AlleleId,double newRate);
+    void updateAlleleLossRate(AlleleImmunity & entry, double newRate);
 private:
+    double computeGeneImmunity(GenePtr const & genePtr, double & validUntil);
+    AlleleBitLayout * getBitLayoutPtr();
+    bool testAlleleBit(AlleleBitLayout * layoutPtr, AlleleKey key);
+    double drawAlleleLossTime(double lossRate);
+    void countAlleleImmunity(AlleleKey key, int64_t delta);
+
 	Host * hostPtr;
 	bool clinical;
     int64_t const locusNumber;
     int64_t infectedTimes = 0;
     double infectionTimesToImmune;
+    // if true, allele immunity loss times are stored in immuneAlleles
+    // and applied on access instead of via AlleleImmuneLossEvents
+    bool lazyAlleleLoss;
+    
+    // Set by the first allele gain; as in the original per-locus lists,
+    // the alleles of that first gain are not written to the database
+    bool gainedAlleleImmunity = false;
+    
+    // Incremented whenever allele immunity is gained or lost; cached gene
+    // immunity levels are valid only for the epoch they were computed in
+    // (and, with lazy loss, until the earliest loss time they depend on)
+    uint64_t immuneEpoch = 0;
+    uint64_t cacheEpoch = 0;
+    double cacheValidUntil = std::numeric_limits<double>::infinity();
+    std::unordered_map<int64_t, double> geneImmunityCache;
+    
+    // One bit per (locus, allele) in immuneAlleles, laid out by
+    // AlleleBitLayout; allocated on first gain, empty if bitsets are off
+    std::vector<uint64_t> immuneAlleleBits;
 };
 
 #endif /* defined(__malariamodel__ImmuneHistory__) */
@@ -9,17 +9,26 @@
 #include "Infection.h"
 #include "SimParameters.h"
 #include "Host.h"
+#include "Population.h"
 #include <sstream>
 #include <algorithm>
 
 using namespace std;
 
+Infection::Infection() :
+	hostPtr(NULL), id(-1), geneIndex(WAITING_STAGE), expressionIndex(0),
+	active(false), transitionTime(0), initialTime(0)
+{
+}
+
 Infection::Infection(Host * hostPtr, int64_t id, StrainPtr & strainPtr, int64_t initialGeneIndex, double initialTime) :
-	hostPtr(hostPtr), id(id), strainPtr(strainPtr),
+	hostPtr(hostPtr), strainPtr(strainPtr), id(narrowId(id, "infection")),
 	geneIndex(initialGeneIndex), active(false),
 	initialTime(initialTime)
 {
+    assert(strainPtr->size() < WAITING_STAGE);
     transitionTime = initialTime;
+    expressionOrder.reserve(strainPtr->size());
     for (int64_t i=0; i<strainPtr->size(); i++) {
         expressionOrder.push_back(i);
     }
@@ -28,11 +37,13 @@ Infection::Infection(Host * hostPtr, int64_t id, StrainPtr & strainPtr, int64_t
 }
 
 Infection::Infection(Host * hostPtr, int64_t id, StrainPtr & strainPtr, GenePtr & msPtr, int64_t initialGeneIndex, double initialTime) :
-hostPtr(hostPtr), id(id), strainPtr(strainPtr),
-msPtr(msPtr), geneIndex(initialGeneIndex), active(false),
+hostPtr(hostPtr), strainPtr(strainPtr), msPtr(msPtr),
+id(narrowId(id, "infection")), geneIndex(initialGeneIndex), active(false),
 initialTime(initialTime)
 {
+    assert(strainPtr->size() < WAITING_STAGE);
     transitionTime = initialTime;
+    expressionOrder.reserve(strainPtr->size());
     for (int64_t i=0; i<strainPtr->size(); i++) {
         expressionOrder.push_back(i);
     }
@@ -67,12 +78,18 @@ int64_t Infection::getCurrentGeneId()
 
 bool Infection::isImmune()
 {
-	return hostPtr->immunity.isImmune(getCurrentGene());
+	if(!hostPtr->immunity) {
+		return false;
+	}
+	return hostPtr->immunity->isImmune(getCurrentGene());
 }
 
 bool Infection::isClinicallyImmune()
 {
-	return hostPtr->clinicalImmunity.isImmune(getCurrentGene());
+	if(!hostPtr->clinicalImmunity) {
+		return false;
+	}
+	return hostPtr->clinicalImmunity->isImmune(getCurrentGene());
 }
 
 double Infection::getTransitionTime()
@@ -95,6 +112,7 @@ void Infection::performTransition()
 	if(geneIndex == WAITING_STAGE) {
 		assert(!active);
 		geneIndex = expressionOrder[expressionIndex];
+		hostPtr->liverStageInfectionCount--;
 	}
 	else if(active) {
 		assert(expressionIndex != strainPtr->size() - 1);
@@ -105,10 +123,13 @@ void Infection::performTransition()
         geneIndex = expressionOrder[expressionIndex];
         //cout<<"turn on "<<geneIndex<<endl;
 		active = false;
+		hostPtr->activeInfectionCount--;
 	}
 	else {
 		active = true;
+		hostPtr->activeInfectionCount++;
 	}
+	hostPtr->popPtr->updateHostIndexSets(*hostPtr);
 	
 	if(shouldUpdateAllInfections) {
 		// Every infection's rates need to be updated
@@ -178,7 +199,7 @@ double Infection::activationRate()
 	assert(!std::isnan(power));
 	assert(!std::isinf(power));
 	
-	double nActiveInfections = hostPtr->getActiveInfectionCount();
+	int64_t nActiveInfections = hostPtr->getActiveInfectionCount();
 	
     /*
 	if(power == 0.0) {
@@ -189,7 +210,7 @@ double Infection::activationRate()
 	if(nActiveInfections == 0) {
 		return std::numeric_limits<double>::infinity();
 	}
-	return constant * std::pow(nActiveInfections, power);
+	return constant * hostPtr->getWithinHostRatesPtr()->activationMoiFactor(nActiveInfections);
 }
 
 double Infection::deactivationRate()
@@ -216,16 +237,19 @@ double Infection::deactivationRate()
             }
         }else{
             //cout<<"geneIndex is "<<geneIndex<<endl;
-            double geneImmuneLevel = hostPtr->immunity.checkGeneImmunity(strainPtr->getGene(geneIndex));
+            double geneImmuneLevel = 0;
+            if(hostPtr->immunity) {
+                geneImmuneLevel = hostPtr->immunity->checkGeneImmunity(strainPtr->getGene(geneIndex));
+            }
             //cout<<"here"<<endl;
             constant = immuneClearRate(immuneRate, constant, geneImmuneLevel);
         }
     }
     //cout<<"host "<<hostPtr->id<<" deactivate gene "<<geneIndex<<" at rate"<<constant<<endl;
     
-	double nActiveInfections = hostPtr->getActiveInfectionCount();
+	int64_t nActiveInfections = hostPtr->getActiveInfectionCount();
 	
-	return constant * std::pow(nActiveInfections, power);
+	return constant * hostPtr->getWithinHostRatesPtr()->deactivationMoiFactor(nActiveInfections);
 }
 
 double Infection::clearanceRate()
@@ -242,14 +266,17 @@ double Infection::clearanceRate()
 		assert(!std::isnan(clearanceRatePower));
 		assert(!std::isinf(clearanceRatePower));
 		
-		double nActiveInfections = hostPtr->getActiveInfectionCount();
+		int64_t nActiveInfections = hostPtr->getActiveInfectionCount();
 		double clearanceRateConstant;
         
         if (simParPtr->selectionMode == 2) {
-            double r1 = simParPtr->withinHost.clearanceRateConstantImmune;
+            //double r1 = simParPtr->withinHost.clearanceRateConstantImmune;
             //double r2 = simParPtr->withinHost.clearanceRateConstantNotImmune;
             //clearanceRateConstant = hostPtr->immunity.checkGeneralImmunity(r1, r2);
-            clearanceRateConstant = hostPtr->immunity.checkGeneralImmunity(simParPtr->withinHost.generalImmunityParams.toDoubleVector(),r1);
+            // tabulated equivalent of checkGeneralImmunity(generalImmunityParams, r1)
+            clearanceRateConstant = hostPtr->getWithinHostRatesPtr()->generalImmunityClearanceRate(
+                hostPtr->immunity ? hostPtr->immunity->getInfectedTimes() : 0
+            );
         }else{
             // if selection mode is not general immunity, then there's effectively no clearance
             clearanceRateConstant = 0.0;
@@ -259,7 +286,7 @@ double Infection::clearanceRate()
 		assert(!std::isinf(clearanceRateConstant));
         //assert(clearanceRateConstant > 0.0);
 		//cout<<clearanceRateConstant<<endl;
-		return clearanceRateConstant * std::pow(nActiveInfections, clearanceRatePower);
+		return clearanceRateConstant * hostPtr->getWithinHostRatesPtr()->clearanceMoiFactor(nActiveInfections);
 	}
 	// Gene inactive: clearance rate = 0
 	else {
@@ -348,100 +375,333 @@ void Infection::write(int64_t transmissionId, Database & db, Table<TransmissionI
 	db.insert(table, row);
 }
 
+/*** WITHIN-HOST RATE TABLES ***/
+
+WithinHostRates::WithinHostRates(SimParameters * parPtr) :
+	immuneClearanceRate(parPtr->withinHost.clearanceRateConstantImmune),
+	activationRatePower(parPtr->withinHost.activationRatePower),
+	deactivationRatePower(parPtr->withinHost.deactivationRatePower),
+	clearanceRatePower(parPtr->withinHost.clearanceRatePower)
+{
+	// General immunity: same fitted curve as ImmuneHistory::checkGeneralImmunity,
+	// one entry per number of past infections below infectionTimesToImmune
+	if(parPtr->selectionMode == 2) {
+		vector<double> params = parPtr->withinHost.generalImmunityParams.toDoubleVector();
+		double infectionTimesToImmune = parPtr->withinHost.infectionTimesToImmune;
+		for(int64_t k = 0; k < infectionTimesToImmune; k++) {
+			double y = params[1]*exp(-params[2]*double(k))/pow((params[3]*double(k)+1.0),params[3])+params[0];
+			generalImmunityClearanceRates.push_back(1/y);
+		}
+	}
+	
+	// MOI factors, tabulated well past maxMOI since it is only a soft limit
+	int64_t nMax = 4 * std::max(int64_t(parPtr->withinHost.maxMOI), int64_t(1));
+	for(int64_t n = 0; n <= nMax; n++) {
+		activationMoiFactors.push_back(std::pow(double(n), activationRatePower));
+		deactivationMoiFactors.push_back(std::pow(double(n), deactivationRatePower));
+		clearanceMoiFactors.push_back(std::pow(double(n), clearanceRatePower));
+	}
+}
+
+double WithinHostRates::generalImmunityClearanceRate(int64_t infectedTimes)
+{
+	assert(infectedTimes >= 0);
+	if(infectedTimes < int64_t(generalImmunityClearanceRates.size())) {
+		return generalImmunityClearanceRates[infectedTimes];
+	}
+	return immuneClearanceRate;
+}
+
+double WithinHostRates::activationMoiFactor(int64_t nActiveInfections)
+{
+	return moiFactor(activationMoiFactors, activationRatePower, nActiveInfections);
+}
+
+double WithinHostRates::deactivationMoiFactor(int64_t nActiveInfections)
+{
+	return moiFactor(deactivationMoiFactors, deactivationRatePower, nActiveInfections);
+}
+
+double WithinHostRates::clearanceMoiFactor(int64_t nActiveInfections)
+{
+	return moiFactor(clearanceMoiFactors, clearanceRatePower, nActiveInfections);
+}
+
+double WithinHostRates::moiFactor(std::vector<double> & factors, double power, int64_t nActiveInfections)
+{
+	assert(nActiveInfections >= 0);
+	if(nActiveInfections < int64_t(factors.size())) {
+		return factors[nActiveInfections];
+	}
+	return std::pow(double(nActiveInfections), power);
+}
+
 /*** INFECTION PROCESS EVENTS ***/
 
 InfectionProcessEvent::InfectionProcessEvent(
-	std::list<Infection>::iterator infectionItr, double time
+	Host * hostPtr, InfectionHandle handle, double time
 ) :
-	RateEvent(time), infectionItr(infectionItr)
+	RateEvent(time), hostPtr(hostPtr), handle(handle)
 {
 }
 
 InfectionProcessEvent::InfectionProcessEvent(
-	std::list<Infection>::iterator infectionItr, double rate, double time, zppsim::rng_t & rng
+	Host * hostPtr, InfectionHandle handle, double rate, double time, zppsim::rng_t & rng
 ) :
-	RateEvent(rate, time, rng), infectionItr(infectionItr)
+	RateEvent(rate, time, rng), hostPtr(hostPtr), handle(handle)
+{
+}
+
+Infection & InfectionProcessEvent::getInfection()
+{
+	return hostPtr->infections.get(handle);
+}
+
+void * InfectionProcessEvent::operator new(size_t size)
 {
+	return ObjectPool<sizeof(InfectionProcessEvent)>::allocate(size);
+}
+
+void InfectionProcessEvent::operator delete(void * ptr, size_t size)
+{
+	ObjectPool<sizeof(InfectionProcessEvent)>::release(ptr, size);
 }
 
 TransitionEvent::TransitionEvent(
-	std::list<Infection>::iterator infectionItr, double time
+	Host * hostPtr, InfectionHandle handle, double time
 ) :
-	InfectionProcessEvent(infectionItr, time)
+	InfectionProcessEvent(hostPtr, handle, time)
 {
 }
 
 
 TransitionEvent::TransitionEvent(
-	std::list<Infection>::iterator infectionItr, double rate, double time, zppsim::rng_t & rng
+	Host * hostPtr, InfectionHandle handle, double rate, double time, zppsim::rng_t & rng
 ) :
-	InfectionProcessEvent(infectionItr, rate, time, rng)
+	InfectionProcessEvent(hostPtr, handle, rate, time, rng)
 {
 }
 
 ClearanceEvent::ClearanceEvent(
-	std::list<Infection>::iterator infectionItr, double rate, double time, zppsim::rng_t & rng
+	Host * hostPtr, InfectionHandle handle, double rate, double time, zppsim::rng_t & rng
 ) :
-	InfectionProcessEvent(infectionItr, rate, time, rng)
+	InfectionProcessEvent(hostPtr, handle, rate, time, rng)
 {
 }
 
 MutationEvent::MutationEvent(
-                               std::list<Infection>::iterator infectionItr, double rate, double time, zppsim::rng_t & rng
+                               Host * hostPtr, InfectionHandle handle, double rate, double time, zppsim::rng_t & rng
                                ) :
-InfectionProcessEvent(infectionItr, rate, time, rng)
+InfectionProcessEvent(hostPtr, handle, rate, time, rng)
 {
 }
 
 RecombinationEvent::RecombinationEvent(
-                             std::list<Infection>::iterator infectionItr, double rate, double time, zppsim::rng_t & rng
+                             Host * hostPtr, InfectionHandle handle, double rate, double time, zppsim::rng_t & rng
                              ) :
-InfectionProcessEvent(infectionItr, rate, time, rng)
+InfectionProcessEvent(hostPtr, handle, rate, time, rng)
 {
 }
 
 MSmutationEvent::MSmutationEvent(
-                                 std::list<Infection>::iterator infectionItr, double rate, double time, zppsim::rng_t & rng
+                                 Host * hostPtr, InfectionHandle handle, double rate, double time, zppsim::rng_t & rng
                                  ) :
-InfectionProcessEvent(infectionItr, rate, time, rng)
+InfectionProcessEvent(hostPtr, handle, rate, time, rng)
 {
 }
 
 void TransitionEvent::performEvent(zppsim::EventQueue &queue)
 {
+	Infection & infection = getInfection();
+	
 	// If this is the final deactivation, then it's equivalent to clearing
-    //cout<<"exId is "<<infectionItr->expressionIndex<<endl;
-	if(infectionItr->active
-		&& infectionItr->expressionIndex == infectionItr->strainPtr->size() - 1
+    //cout<<"exId is "<<infection.expressionIndex<<endl;
+	if(infection.active
+		&& infection.expressionIndex == infection.strainPtr->size() - 1
 	) {
         //cout<<"perform clearing"<<endl;
-		infectionItr->hostPtr->clearInfection(infectionItr);
+		hostPtr->clearInfection(handle);
 	}
 	// Otherwise, actually perform a transition
 	else {
-		infectionItr->performTransition();
+		infection.performTransition();
 	}
 }
 
 void ClearanceEvent::performEvent(zppsim::EventQueue &queue)
 {
-	infectionItr->hostPtr->clearInfection(infectionItr);
+	hostPtr->clearInfection(handle);
 }
 
 void MutationEvent::performEvent(zppsim::EventQueue &queue)
 {
-    infectionItr->hostPtr->hstMutateStrain(infectionItr);
+    hostPtr->hstMutateStrain(getInfection());
     //cout<<"mutated"<<endl;
 }
 
 void RecombinationEvent::performEvent(zppsim::EventQueue &queue)
 {
-    infectionItr->hostPtr->RecombineStrain(infectionItr);
+    hostPtr->RecombineStrain(getInfection());
     //cout<<"recomb"<<endl;
 }
 
 void MSmutationEvent::performEvent(zppsim::EventQueue &queue)
 {
-    infectionItr->hostPtr->microsatMutate(infectionItr);
+    hostPtr->microsatMutate(getInfection());
     //cout<<"microsatMutate"<<endl;
 }
+
+/*** INFECTION STORE ***/
+
+InfectionStore::iterator::iterator(InfectionStore * storePtr, size_t slot) :
+	storePtr(storePtr), slot(slot)
+{
+}
+
+Infection & InfectionStore::iterator::operator*()
+{
+	return storePtr->slots[slot].infection;
+}
+
+Infection * InfectionStore::iterator::operator->()
+{
+	return &storePtr->slots[slot].infection;
+}
+
+InfectionStore::iterator & InfectionStore::iterator::operator++()
+{
+	slot = storePtr->firstOccupied(slot + 1);
+	return *this;
+}
+
+InfectionStore::iterator InfectionStore::iterator::operator++(int)
+{
+	iterator itr = *this;
+	++(*this);
+	return itr;
+}
+
+bool InfectionStore::iterator::operator==(iterator const & other) const
+{
+	return slot == other.slot;
+}
+
+bool InfectionStore::iterator::operator!=(iterator const & other) const
+{
+	return slot != other.slot;
+}
+
+InfectionHandle InfectionStore::iterator::handle()
+{
+	return InfectionHandle { uint32_t(slot), storePtr->slots[slot].generation };
+}
+
+InfectionStore::InfectionStore() : count(0)
+{
+}
+
+InfectionStore::iterator InfectionStore::begin()
+{
+	return iterator(this, firstOccupied(0));
+}
+
+InfectionStore::iterator InfectionStore::end()
+{
+	return iterator(this, slots.size());
+}
+
+size_t InfectionStore::size()
+{
+	return count;
+}
+
+bool InfectionStore::empty()
+{
+	return count == 0;
+}
+
+void InfectionStore::reserve(size_t capacity)
+{
+	slots.reserve(capacity);
+}
+
+size_t InfectionStore::capacity()
+{
+	return slots.capacity();
+}
+
+size_t InfectionStore::slotSize()
+{
+	return sizeof(Slot);
+}
+
+InfectionHandle InfectionStore::insert(Infection && infection)
+{
+	count++;
+	size_t slot = 0;
+	while(slot < slots.size() && slots[slot].occupied) {
+		slot++;
+	}
+	if(slot == slots.size()) {
+		slots.push_back(Slot { std::move(infection), 0, true });
+	}
+	else {
+		slots[slot].infection = std::move(infection);
+		slots[slot].occupied = true;
+	}
+	return InfectionHandle { uint32_t(slot), slots[slot].generation };
+}
+
+// Whether the handle still refers to a live infection: false once the
+// infection has been erased, even if its slot has since been reused
+bool InfectionStore::contains(InfectionHandle handle)
+{
+	return handle.slot < slots.size()
+		&& slots[handle.slot].occupied
+		&& slots[handle.slot].generation == handle.generation;
+}
+
+Infection & InfectionStore::get(InfectionHandle handle)
+{
+	assert(contains(handle));
+	return slots[handle.slot].infection;
+}
+
+void InfectionStore::erase(InfectionHandle handle)
+{
+	assert(contains(handle));
+	Slot & slot = slots[handle.slot];
+	
+	// Release strain and events now rather than on reuse
+	slot.infection = Infection();
+	slot.occupied = false;
+	slot.generation++;
+	count--;
+}
+
+InfectionStore::iterator InfectionStore::erase(iterator itr)
+{
+	erase(itr.handle());
+	++itr;
+	return itr;
+}
+
+void InfectionStore::clear()
+{
+	for(auto & slot : slots) {
+		if(slot.occupied) {
+			slot.infection = Infection();
+			slot.occupied = false;
+			slot.generation++;
+		}
+	}
+	count = 0;
+}
+
+size_t InfectionStore::firstOccupied(size_t slot)
+{
+	while(slot < slots.size() && !slots[slot].occupied) {
+		slot++;
+	}
+	return slot;
+}
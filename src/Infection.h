@@ -9,33 +9,83 @@
 #ifndef __malariamodel__Infection__
 #define __malariamodel__Infection__
 
-#include <list>
-
 #include "EventQueue.hpp"
 #include "zppsim_util.hpp"
 #include "Strain.h"
 #include "zppdb.hpp"
 #include "DatabaseTypes.h"
+#include "ObjectPool.h"
 #include <algorithm>
 
 class Infection;
 class Host;
+class SimParameters;
+
+/**
+	\brief Precomputed within-host rate factors.
+	
+	Built once from SimParameters: the general-immunity clearance rate
+	indexed by number of past infections, and the MOI power-law factors
+	`n^power` for activation, deactivation and clearance indexed by number of
+	active infections (computed directly beyond the table).
+*/
+class WithinHostRates
+{
+public:
+	WithinHostRates(SimParameters * parPtr);
+	
+	double generalImmunityClearanceRate(int64_t infectedTimes);
+	double activationMoiFactor(int64_t nActiveInfections);
+	double deactivationMoiFactor(int64_t nActiveInfections);
+	double clearanceMoiFactor(int64_t nActiveInfections);
+private:
+	std::vector<double> generalImmunityClearanceRates;
+	double immuneClearanceRate;
+	
+	double activationRatePower;
+	double deactivationRatePower;
+	double clearanceRatePower;
+	std::vector<double> activationMoiFactors;
+	std::vector<double> deactivationMoiFactors;
+	std::vector<double> clearanceMoiFactors;
+	
+	double moiFactor(std::vector<double> & factors, double power, int64_t nActiveInfections);
+};
+
+/**
+	\brief Stable reference to an infection in its host's InfectionStore.
+	
+	Slot index plus the generation of that slot when the infection was
+	stored; the handle goes stale once the infection is removed.
+*/
+struct InfectionHandle
+{
+	uint32_t slot;
+	uint32_t generation;
+};
 
 class InfectionProcessEvent : public zppsim::RateEvent
 {
 public:
-	InfectionProcessEvent(std::list<Infection>::iterator infectionItr, double time);
-	InfectionProcessEvent(std::list<Infection>::iterator infectionItr,
+	InfectionProcessEvent(Host * hostPtr, InfectionHandle handle, double time);
+	InfectionProcessEvent(Host * hostPtr, InfectionHandle handle,
 		double rate, double time, zppsim::rng_t & rng);
 	
-	std::list<Infection>::iterator infectionItr;
+	Host * hostPtr;
+	InfectionHandle handle;
+	
+	Infection & getInfection();
+	
+	// All five event kinds share one pool (they add no members)
+	static void * operator new(size_t size);
+	static void operator delete(void * ptr, size_t size);
 };
 
 class TransitionEvent : public InfectionProcessEvent
 {
 public:
-	TransitionEvent(std::list<Infection>::iterator infectionItr, double time);
-	TransitionEvent(std::list<Infection>::iterator infectionItr,
+	TransitionEvent(Host * hostPtr, InfectionHandle handle, double time);
+	TransitionEvent(Host * hostPtr, InfectionHandle handle,
 		double rate, double initTime, zppsim::rng_t & rng);
 	virtual void performEvent(zppsim::EventQueue & queue);
 };
@@ -43,7 +93,7 @@ public:
 class ClearanceEvent : public InfectionProcessEvent
 {
 public:
-	ClearanceEvent(std::list<Infection>::iterator infectionItr,
+	ClearanceEvent(Host * hostPtr, InfectionHandle handle,
 		double rate, double initTime, zppsim::rng_t & rng);
 	virtual void performEvent(zppsim::EventQueue & queue);
 };
@@ -52,7 +102,7 @@ public:
 class MutationEvent : public InfectionProcessEvent
 {
 public:
-	MutationEvent(std::list<Infection>::iterator infectionItr,
+	MutationEvent(Host * hostPtr, InfectionHandle handle,
                    double rate, double initTime, zppsim::rng_t & rng);
 	virtual void performEvent(zppsim::EventQueue & queue);
 };
@@ -61,7 +111,7 @@ public:
 class RecombinationEvent : public InfectionProcessEvent
 {
 public:
-	RecombinationEvent(std::list<Infection>::iterator infectionItr,
+	RecombinationEvent(Host * hostPtr, InfectionHandle handle,
                   double rate, double initTime, zppsim::rng_t & rng);
 	virtual void performEvent(zppsim::EventQueue & queue);
 };
@@ -70,7 +120,7 @@ public:
 class MSmutationEvent: public InfectionProcessEvent
 {
 public:
-	MSmutationEvent(std::list<Infection>::iterator infectionItr,
+	MSmutationEvent(Host * hostPtr, InfectionHandle handle,
                     double rate, double initTime, zppsim::rng_t & rng);
 	virtual void performEvent(zppsim::EventQueue & queue);
     
@@ -79,7 +129,10 @@ public:
 class Infection
 {
 friend class Host;
+friend class Simulation;
 public:
+	// empty infection, used for unoccupied InfectionStore slots
+	Infection();
 	Infection(Host * hostPtr, int64_t id, StrainPtr & strainPtr, int64_t initialGeneIndex, double initialTime);
     Infection(Host * hostPtr, int64_t id, StrainPtr & strainPtr, GenePtr & msPtr, int64_t initialGeneIndex, double initialTime);
 
@@ -89,9 +142,11 @@ public:
 	StrainPtr strainPtr;
 	GenePtr msPtr;
     
-	int64_t id;
+	int32_t id;
 	
-	int64_t geneIndex;
+	// index into strainPtr, or WAITING_STAGE
+	int16_t geneIndex;
+	int16_t expressionIndex;
 	bool active;
 	double transitionTime;
     double initialTime;
@@ -126,13 +181,73 @@ public:
 	
 	void write(Database & db, Table<InfectionRow> & table,Table<StrainRow> & strainsTable,Table<GeneRow> & GeneTable,Table<LociRow> & LociTable);
 	void write(int64_t transmissionId, Database & db, Table<TransmissionInfectionRow> & table);
-    int expressionIndex;
 	
 private:
 	double activationRate();
 	double deactivationRate();
-    std::vector<int64_t> expressionOrder;
+    std::vector<int16_t> expressionOrder;
     double immuneClearRate(double immuneRate, double notImmuneRate, double immuneLevel);
 };
 
+/**
+	\brief Per-host infection container.
+	
+	Infections live in one contiguous array of slots, reserved to `maxMOI`
+	on a host's first infection and kept across host reuse, growing only for
+	the rare host above that. Events refer to infections by InfectionHandle;
+	a removed infection's slot is emptied and reused by the next infection.
+	Iteration visits occupied slots in slot order.
+*/
+class InfectionStore
+{
+public:
+	class iterator
+	{
+	public:
+		iterator(InfectionStore * storePtr, size_t slot);
+		
+		Infection & operator*();
+		Infection * operator->();
+		iterator & operator++();
+		iterator operator++(int);
+		bool operator==(iterator const & other) const;
+		bool operator!=(iterator const & other) const;
+		
+		InfectionHandle handle();
+	private:
+		InfectionStore * storePtr;
+		size_t slot;
+		
+		friend class InfectionStore;
+	};
+	
+	InfectionStore();
+	
+	iterator begin();
+	iterator end();
+	size_t size();
+	bool empty();
+	
+	void reserve(size_t capacity);
+	size_t capacity();
+	static size_t slotSize();
+	InfectionHandle insert(Infection && infection);
+	bool contains(InfectionHandle handle);
+	Infection & get(InfectionHandle handle);
+	void erase(InfectionHandle handle);
+	iterator erase(iterator itr);
+	void clear();
+private:
+	struct Slot
+	{
+		Infection infection;
+		uint32_t generation;
+		bool occupied;
+	};
+	std::vector<Slot> slots;
+	size_t count;
+	
+	size_t firstOccupied(size_t slot);
+};
+
 #endif /* defined(__malariamodel__Infection__) */
@@ -0,0 +1,88 @@
+//
+//  ObjectPool.h
+//  malariamodel
+//
+
+#ifndef __malariamodel__ObjectPool__
+#define __malariamodel__ObjectPool__
+
+#include <cstddef>
+#include <new>
+#include <vector>
+#include <memory>
+
+/**
+	\brief Free-list allocator for small fixed-size objects.
+
+	Used through class-specific operator new/delete by objects that are
+	created and destroyed at high rates (per-infection and immunity-loss
+	events), so that steady-state churn reuses blocks instead of going through
+	malloc. Long-lived objects allocated in bulk (host death events) use it
+	too, so that they take one allocation per chunk. Blocks are carved from chunks of `CHUNK_SIZE` objects; released
+	blocks go onto a free list and memory is kept until exit. Requests of any
+	other size (e.g. a subclass with extra members) fall back to the global
+	allocator. Not thread-safe.
+*/
+template<size_t ObjectSize>
+class ObjectPool
+{
+public:
+	static void * allocate(size_t size)
+	{
+		if(size != ObjectSize) {
+			return ::operator new(size);
+		}
+		ObjectPool & pool = instance();
+		if(pool.freeList == NULL) {
+			pool.addChunk();
+		}
+		Block * block = pool.freeList;
+		pool.freeList = block->next;
+		return block;
+	}
+
+	static void release(void * ptr, size_t size)
+	{
+		if(ptr == NULL) {
+			return;
+		}
+		if(size != ObjectSize) {
+			::operator delete(ptr);
+			return;
+		}
+		ObjectPool & pool = instance();
+		Block * block = static_cast<Block *>(ptr);
+		block->next = pool.freeList;
+		pool.freeList = block;
+	}
+
+private:
+	union Block
+	{
+		Block * next;
+		alignas(std::max_align_t) unsigned char storage[ObjectSize];
+	};
+
+	static size_t const CHUNK_SIZE = 1024;
+
+	Block * freeList = NULL;
+	std::vector<std::unique_ptr<Block[]>> chunks;
+
+	static ObjectPool & instance()
+	{
+		static ObjectPool pool;
+		return pool;
+	}
+
+	void addChunk()
+	{
+		chunks.emplace_back(new Block[CHUNK_SIZE]);
+		Block * chunk = chunks.back().get();
+		for(size_t i = 0; i < CHUNK_SIZE; i++) {
+			chunk[i].next = freeList;
+			freeList = &chunk[i];
+		}
+	}
+};
+
+#endif /* defined(__malariamodel__ObjectPool__) */
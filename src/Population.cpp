@@ -33,20 +33,33 @@ Population::Population(Simulation * simPtr, int64_t id) :
 		double deathTime = birthTime + lifetime;
 		
 		bool writeToDatabase = simPtr->parPtr->outputHosts;
-		hosts.emplace_back(new Host(
+		hosts.emplace_back(
 			this, hostId, birthTime, deathTime,
 			writeToDatabase,
 			*(simPtr->dbPtr),
 			simPtr->hostsTable
-		));
-		hostIdIndexMap[hostId] = hosts.size() - 1;
+		);
 	}
 	
-	// Create biting event
-	bitingEvent = unique_ptr<BitingEvent>(
-		new BitingEvent(this, getBitingRate(), simPtr->rng)
-	);
-	addEvent(bitingEvent.get());
+	// Create biting event; a batched population draws its first batch once
+	// destination tables exist (Simulation::updateDestinationTables)
+	if(simPtr->parPtr->biteBatchWindow.present()) {
+		biteBatchRate = getBitingRate();
+		biteBatchEvent = unique_ptr<BiteBatchEvent>(new BiteBatchEvent(this, 0.0));
+		addEvent(biteBatchEvent.get());
+	}
+	else {
+		bitingEvent = unique_ptr<BitingEvent>(
+			new BitingEvent(this, getTransmittingBiteRate(), simPtr->rng)
+		);
+		addEvent(bitingEvent.get());
+	}
+	if(simPtr->infectiousSourceBiting) {
+		nonInfectiousBiteEvent = unique_ptr<NonInfectiousBiteEvent>(
+			new NonInfectiousBiteEvent(this, getRecordedNonInfectiousBiteRate(), simPtr->rng)
+		);
+		addEvent(nonInfectiousBiteEvent.get());
+	}
 	
 	// Create immigration event
 	immigrationEvent = unique_ptr<ImmigrationEvent>(
@@ -55,6 +68,7 @@ Population::Population(Simulation * simPtr, int64_t id) :
 	addEvent(immigrationEvent.get());
 	
 	// Create initial infections, with microsatellites as well
+	deferBiteRateUpdates = true;
     if (simPtr->parPtr->genes.includeMicrosat) {
         size_t msSampleSize = (int)(parPtr->nInitialInfections + (parPtr->immigrationRate * 360.0))*1.5;
         simPtr->runMSSimCoal(msSampleSize);
@@ -63,16 +77,23 @@ Population::Population(Simulation * simPtr, int64_t id) :
             int64_t hostId = drawUniformIndex(simPtr->rng, hosts.size());
             StrainPtr strainPtr = simPtr->generateRandomStrain();
             GenePtr msPtr = simPtr->storeMicrosat(tempMS[i]);
-            hosts[hostId]->receiveInfection(strainPtr,msPtr);
+            hosts[hostId].receiveInfection(strainPtr,msPtr);
         }
         immigrationCount = parPtr->nInitialInfections;
     }else{
         for(int64_t i = 0; i < parPtr->nInitialInfections; i++) {
 		int64_t hostId = drawUniformIndex(simPtr->rng, hosts.size());
 		StrainPtr strainPtr = simPtr->generateRandomStrain();
-		hosts[hostId]->receiveInfection(strainPtr);
+		hosts[hostId].receiveInfection(strainPtr);
         }
 	}
+	
+	deferBiteRateUpdates = false;
+	
+	// biting rates depend on the initial infections
+	if(simPtr->infectiousSourceBiting) {
+		updateRates();
+	}
 }
 
 int64_t Population::size()
@@ -82,28 +103,16 @@ int64_t Population::size()
 
 Host * Population::getHostAtIndex(int64_t hostIndex)
 {
-	return hosts[hostIndex].get();
+	return &hosts[hostIndex];
 }
 
-void Population::removeHost(Host * hostPtr)
+void Population::replaceHost(Host * hostPtr)
 {
-	int64_t index = hostIdIndexMap[hostPtr->id];
-	hostIdIndexMap.erase(hostPtr->id);
-	if(index < hosts.size() - 1) {
-		hosts[index] = std::move(hosts.back());
-		hostIdIndexMap[hosts[index]->id] = index;
-	}
-	hosts.pop_back();
-	
 	// In the future, need to update rates
 //	updateRates();
 	
-	// For now, just create a new one so pop size doesn't change
-	createNewHost();
-}
-
-Host * Population::createNewHost()
-{
+	// For now, the population size doesn't change: reuse the dying host's
+	// slot for a newborn
 	//double lifetime = simPtr->drawHostLifetime();
     double lifetime = exponential_distribution<>(1.0/10800.0)(*rngPtr);
     if (lifetime > 28800.0) lifetime = 28800.0;
@@ -112,24 +121,53 @@ Host * Population::createNewHost()
 	
 	int64_t hostId = simPtr->nextHostId++;
 	bool writeToDatabase = simPtr->parPtr->outputHosts;
-	hosts.emplace_back(new Host(
-		this, hostId, birthTime, deathTime,
+	hostPtr->reset(
+		hostId, birthTime, deathTime,
 		writeToDatabase, *(simPtr->dbPtr), simPtr->hostsTable
-	));
-	hostIdIndexMap[hostId] = hosts.size() - 1;
+	);
 	
-	// In the future, need to update rates
-//	updateRates();
     if (simPtr->parPtr->following.includeHostFollowing) {
         double t = getTime();
         if ((t > simPtr->parPtr->burnIn) && (numberOfHostsFollowed < simPtr->parPtr->following.HostNumber))
         {
-            hosts.back()->toTrack = true;
+            hostPtr->toTrack = true;
             numberOfHostsFollowed += 1;
             cout << "following hosts " <<hostId<<endl;
         }
     }
-	return hosts.back().get();
+}
+
+// Brings the infected/active host index sets up to date after the host's
+// infections change
+void Population::updateHostIndexSets(Host & host)
+{
+	int32_t hostIndex = int32_t(&host - hosts.data());
+	size_t nInfected = infectedHostIndices.size();
+	updateIndexSet(infectedHostIndices, &Host::infectedSetPos, hostIndex, host.getInfectionCount() > 0);
+	updateIndexSet(activeHostIndices, &Host::activeSetPos, hostIndex, host.getActiveInfectionCount() > 0);
+	
+	if(simPtr->infectiousSourceBiting && !deferBiteRateUpdates
+		&& infectedHostIndices.size() != nInfected
+	) {
+		updateBiteEventRates();
+	}
+}
+
+void Population::updateIndexSet(std::vector<int32_t> & indexSet, int32_t Host::* posField, int32_t hostIndex, bool member)
+{
+	int32_t & pos = hosts[hostIndex].*posField;
+	if(member && pos < 0) {
+		pos = int32_t(indexSet.size());
+		indexSet.push_back(hostIndex);
+	}
+	else if(!member && pos >= 0) {
+		// Swap the last member into the vacated position
+		int32_t lastIndex = indexSet.back();
+		indexSet[pos] = lastIndex;
+		hosts[lastIndex].*posField = pos;
+		indexSet.pop_back();
+		pos = -1;
+	}
 }
 
 double Population::getTime()
@@ -151,6 +189,24 @@ double Population::getBitingRate()
 	return hosts.size() * perHostBitingRate * IRSBitingAmplitude;
 }
 
+// Rate of biting events: all bites, or with infectiousSourceBiting only
+// bites whose source host is infected
+double Population::getTransmittingBiteRate()
+{
+	if(!simPtr->infectiousSourceBiting) {
+		return getBitingRate();
+	}
+	return getBitingRate() * infectedHostIndices.size() / double(hosts.size());
+}
+
+// Rate of bites from uninfected hosts that would have been recorded
+// in the EIR table
+double Population::getRecordedNonInfectiousBiteRate()
+{
+	double nUninfected = hosts.size() - infectedHostIndices.size();
+	return getBitingRate() * nUninfected / double(hosts.size()) * EIR_SAMPLING_PROBABILITY;
+}
+
 double Population::getImmigrationRate()
 {
 	return parPtr->immigrationRate;
@@ -180,25 +236,22 @@ void Population::performBitingEvent()
 {
 //	cerr << simPtr->getTime() << ": biting event, src pop " << id << '\n';
 	
-	int64_t srcHostIndex = drawUniformIndex(*rngPtr, hosts.size());
-	Host * srcHostPtr = hosts[srcHostIndex].get();
-//	cerr << "src host: " << srcHostPtr->id << '\n';
+	Host * srcHostPtr = drawBitingSourceHost();
 	
 	Host * dstHostPtr = simPtr->drawDestinationHost(id);
 //	cerr << "dst pop, host: " << dstHostPtr->popPtr->id << ", " << dstHostPtr->id << '\n';
-    bool NoMDAflag = true;
-    if ((simPtr->parPtr->MDA.includeMDA) &&
-    (dstHostPtr->MDAEndTime>(getTime()+simPtr->parPtr->tLiverStage)))
-    {
-        //express before the MDA is over, then do not perform biting
-        bernoulli_distribution flipCoin(1-simPtr->parPtr->MDA.strainFailRate);
-        if(flipCoin(*rngPtr)){
-            NoMDAflag = false;
-        }
-    }
+	performBite(srcHostPtr, dstHostPtr);
+}
+
+void Population::performBite(Host * srcHostPtr, Host * dstHostPtr)
+{
+    bool NoMDAflag = !drawMDABlocksBite(dstHostPtr);
     
     if (NoMDAflag) {
-        if (simPtr->parPtr->genes.includeMicrosat) {
+        if (srcHostPtr == NULL) {
+            // same record transmitTo makes for an uninfected source
+            simPtr->writeEIR(getTime(), 0);
+        }else if (simPtr->parPtr->genes.includeMicrosat) {
             srcHostPtr->transmitMSTo(*dstHostPtr);
         }else{
             srcHostPtr->transmitTo(*dstHostPtr);
@@ -206,23 +259,111 @@ void Population::performBitingEvent()
     }
 }
 
-//disable immigration first
-void Population::performImmigrationEvent()
+// A bite on a host protected by MDA (expressing before the drug wears off)
+// fails to establish, except for strains that escape the drug
+bool Population::drawMDABlocksBite(Host * dstHostPtr)
 {
-//	cerr << getTime() << ": immigration event, pop " << id << '\n';
-	int64_t hostIndex = drawUniformIndex(*rngPtr, hosts.size());
-
-    
-    bool NoMDAflag = true;
     if ((simPtr->parPtr->MDA.includeMDA) &&
-        (hosts[hostIndex]->MDAEndTime>(getTime()+simPtr->parPtr->tLiverStage)))
+    (dstHostPtr->MDAEndTime>(getTime()+simPtr->parPtr->tLiverStage)))
     {
         //express before the MDA is over, then do not perform biting
         bernoulli_distribution flipCoin(1-simPtr->parPtr->MDA.strainFailRate);
         if(flipCoin(*rngPtr)){
-            NoMDAflag = false;
+            return true;
         }
     }
+    return false;
+}
+
+void Population::performNonInfectiousBiteEvent()
+{
+	Host * dstHostPtr = simPtr->drawDestinationHost(id);
+	if(!drawMDABlocksBite(dstHostPtr)) {
+		// already thinned by EIR_SAMPLING_PROBABILITY
+		simPtr->insertEIRRow(getTime(), 0);
+	}
+}
+
+// Draws the source of a bite uniformly over all hosts, but only resolves
+// which host it is if it is infected; returns NULL for an uninfected source.
+// With infectiousSourceBiting every bite has an infected source.
+Host * Population::drawBitingSourceHost()
+{
+	if(simPtr->infectiousSourceBiting) {
+		assert(infectedHostIndices.size() > 0);
+		return &hosts[infectedHostIndices[drawUniformIndex(*rngPtr, infectedHostIndices.size())]];
+	}
+	return getBitingSourceHost(drawUniformIndex(*rngPtr, hosts.size()));
+}
+
+// Source host for a uniformly drawn index in [0, size()): the first
+// infectedHostIndices.size() indices stand for the infected hosts, the
+// rest for uninfected ones (NULL)
+Host * Population::getBitingSourceHost(int64_t srcIndex)
+{
+	assert(srcIndex >= 0 && srcIndex < int64_t(hosts.size()));
+	if(srcIndex >= int64_t(infectedHostIndices.size())) {
+		return NULL;
+	}
+	return &hosts[infectedHostIndices[srcIndex]];
+}
+
+// Draws the bites in [startTime, startTime + biteBatchWindow) as a Poisson
+// process at biteBatchRate, with their source indices, and schedules the
+// first. Source hosts are resolved at bite time, since which hosts are
+// infected changes; destinations are drawn at bite time from the current
+// destination tables, so other populations' rate changes leave the batch
+// valid.
+void Population::drawBiteBatch(double startTime)
+{
+	biteBatchEnd = startTime + simPtr->parPtr->biteBatchWindow;
+	biteBatch.clear();
+	nextBite = 0;
+	if(biteBatchRate > 0.0) {
+		exponential_distribution<> waitDist(biteBatchRate);
+		for(double t = startTime + waitDist(*rngPtr); t < biteBatchEnd; t += waitDist(*rngPtr)) {
+			biteBatch.push_back({ t, 0 });
+		}
+	}
+	for(auto & bite : biteBatch) {
+		bite.srcIndex = int32_t(drawUniformIndex(*rngPtr, hosts.size()));
+	}
+	setEventTime(biteBatchEvent.get(), biteBatch.empty() ? biteBatchEnd : biteBatch[0].time);
+}
+
+// Discards the rest of the current batch and draws a new one from now, after
+// this population's biting rate changes; bites are memoryless, so this is exact
+void Population::restartBiteBatch()
+{
+	drawBiteBatch(getTime());
+}
+
+void Population::performBiteBatchEvent()
+{
+	if(nextBite == biteBatch.size()) {
+		drawBiteBatch(biteBatchEnd);
+		return;
+	}
+	
+	PendingBite & bite = biteBatch[nextBite++];
+	assert(bite.time == getTime());
+	Host * srcHostPtr = getBitingSourceHost(bite.srcIndex);
+	Host * dstHostPtr = simPtr->drawDestinationHost(id);
+	performBite(srcHostPtr, dstHostPtr);
+	
+	setEventTime(biteBatchEvent.get(),
+		nextBite < biteBatch.size() ? biteBatch[nextBite].time : biteBatchEnd
+	);
+}
+
+//disable immigration first
+void Population::performImmigrationEvent()
+{
+//	cerr << getTime() << ": immigration event, pop " << id << '\n';
+	int64_t hostIndex = drawUniformIndex(*rngPtr, hosts.size());
+
+    
+    bool NoMDAflag = !drawMDABlocksBite(&hosts[hostIndex]);
     
     
     if(NoMDAflag){
@@ -247,10 +388,10 @@ void Population::performImmigrationEvent()
             
             }
             GenePtr ms = simPtr->storeMicrosat(tempMS[immigrationCount]);
-            hosts[hostIndex]->receiveInfection(strain,ms);
+            hosts[hostIndex].receiveInfection(strain,ms);
             immigrationCount++;
         }else{
-            hosts[hostIndex]->receiveInfection(strain);
+            hosts[hostIndex].receiveInfection(strain);
         }
         }
 }
@@ -274,7 +415,32 @@ double Population::getDistance(Population * popPtr)
 
 void Population::updateRates()
 {
-	setEventRate(bitingEvent.get(), getBitingRate());
+	if(biteBatchEvent) {
+		double bitingRate = getBitingRate();
+		if(bitingRate != biteBatchRate) {
+			biteBatchRate = bitingRate;
+			restartBiteBatch();
+		}
+	}
+	else {
+		updateBiteEventRates();
+	}
+}
+
+// Sets the biting (and non-infectious bite) event rates, leaving events
+// whose rate is unchanged where they are in the queue
+void Population::updateBiteEventRates()
+{
+	double bitingRate = getTransmittingBiteRate();
+	if(bitingRate != bitingEvent->getRate()) {
+		setEventRate(bitingEvent.get(), bitingRate);
+	}
+	if(nonInfectiousBiteEvent) {
+		double nonInfectiousRate = getRecordedNonInfectiousBiteRate();
+		if(nonInfectiousRate != nonInfectiousBiteEvent->getRate()) {
+			setEventRate(nonInfectiousBiteEvent.get(), nonInfectiousRate);
+		}
+	}
 }
 
 void Population::sampleHosts()
@@ -285,35 +451,38 @@ void Population::sampleHosts()
 		*rngPtr, hosts.size(), size_t(parPtr->sampleSize), true
 	);*/
     //change the samplingHosts to sample enough infected according to sampleSize
-    vector<size_t> hostIndices = drawUniformIndices(
-         *rngPtr, hosts.size(), hosts.size(), true);
+    //hosts are visited in index order; only hosts with active infections
+    //matter, so walk those (sorted) and count the hosts passed over
+    vector<int32_t> hostIndices = activeHostIndices;
+    std::sort(hostIndices.begin(), hostIndices.end());
     size_t count = 0;
     size_t moi1count = 0;
-    size_t sampledSize = 0;
+    size_t sampledSize = hosts.size();
 	for(size_t index : hostIndices) {
 		//SampledHostRow row;
 		//row.time = getTime();
         //this line records every sampled host
-		//row.hostId = hosts[index]->id;
+		//row.hostId = hosts[index].id;
         //dbPtr->insert(simPtr->sampledHostsTable, row);
         //instead, in this version record only how many hosts were sampled before reaching the infected sampleSize
-        sampledSize += 1;
-        int64_t numActiveInfection = hosts[index]->getActiveInfectionCount();
+        int64_t numActiveInfection = hosts[index].getActiveInfectionCount();
 		if (numActiveInfection>0) {
-            hosts[index]->writeInfections(*dbPtr, simPtr->sampledHostInfectionTable, simPtr->strainsTable,simPtr->genesTable,simPtr->lociTable);
+            hosts[index].writeInfections(*dbPtr, simPtr->sampledHostInfectionTable, simPtr->strainsTable,simPtr->genesTable,simPtr->lociTable);
             count += 1;
             if (numActiveInfection ==1) {
                 moi1count += 1;
             }
-		//hosts[index]->immunity.write(*dbPtr, simPtr->sampledHostImmunityTable);
-		//hosts[index]->clinicalImmunity.write(*dbPtr, simPtr->sampledHostClinicalImmunityTable);
+		//hosts[index].immunity.write(*dbPtr, simPtr->sampledHostImmunityTable);
+		//hosts[index].clinicalImmunity.write(*dbPtr, simPtr->sampledHostClinicalImmunityTable);
         }
         if (parPtr->moi1) {
             if (moi1count == size_t(parPtr->sampleSize)) {
+                sampledSize = index + 1;
                 break;
             }
         }else{
             if (count == size_t(parPtr->sampleSize)) {
+                sampledSize = index + 1;
                 break;
             }
         }
@@ -325,6 +494,104 @@ void Population::sampleHosts()
     row.time = getTime();
     row.sampledNumber = sampledSize;
     dbPtr->insert(simPtr->sampledHostsTable, row);
+    
+    if(simPtr->trackImmunityCoverage) {
+        writeAlleleImmunityCoverage();
+        writeAlleleImmunityOverlap();
+    }
+}
+
+bool Population::verifyState()
+{
+	for(auto & host : hosts) {
+		if(!host.verifyInfectionCounts()) {
+			cerr << "Infection counts out of sync for " << host.toString() << '\n';
+			return false;
+		}
+		if((host.infectedSetPos >= 0) != (host.getInfectionCount() > 0)
+			|| (host.activeSetPos >= 0) != (host.getActiveInfectionCount() > 0)) {
+			cerr << "Infected host index out of sync for " << host.toString() << '\n';
+			return false;
+		}
+	}
+	return true;
+}
+
+void Population::sweepImmunity()
+{
+    for(auto & host : hosts) {
+        if(host.immunity) {
+            host.immunity->expireAlleles();
+            host.releaseNaiveState();
+        }
+    }
+}
+
+void Population::compactImmunity()
+{
+    for(auto & host : hosts) {
+        if(host.immunity) {
+            host.immunity->compact();
+        }
+        if(host.clinicalImmunity) {
+            host.clinicalImmunity->compact();
+        }
+        host.releaseNaiveState();
+    }
+}
+
+void Population::updateAlleleImmunityCount(AlleleKey key, int64_t delta)
+{
+    if(!simPtr->trackImmunityCoverage) {
+        return;
+    }
+    int64_t & count = alleleImmuneHostCounts[key];
+    count += delta;
+    assert(count >= 0);
+    if(count == 0) {
+        alleleImmuneHostCounts.erase(key);
+    }
+}
+
+void Population::writeAlleleImmunityCoverage()
+{
+    // with lazy immunity loss, counts include immunity that has expired
+    // but has not yet been read or swept
+    AlleleImmunityCoverageRow row;
+    row.time = getTime();
+    row.popId = id;
+    for(auto & kv : alleleImmuneHostCounts) {
+        row.locusIndex = kv.first.locusId();
+        row.alleleId = kv.first.alleleId();
+        row.hostCount = kv.second;
+        simPtr->dbPtr->insert(simPtr->alleleImmunityCoverageTable, row);
+    }
+}
+
+// Repertoire size and overlap, by popcount when allele bitsets are on. Overlap
+// is averaged over hosts in neighbouring slots, which are unrelated (slots
+// are reused in place), so no random numbers are drawn for output.
+void Population::writeAlleleImmunityOverlap()
+{
+    int64_t immuneTotal = 0;
+    int64_t sharedTotal = 0;
+    for(size_t i = 0; i < hosts.size(); i++) {
+        ImmuneHistory * immHistPtr = hosts[i].immunity.get();
+        ImmuneHistory * nextImmHistPtr = hosts[(i + 1) % hosts.size()].immunity.get();
+        if(immHistPtr != NULL) {
+            immuneTotal += immHistPtr->immuneAlleleCount();
+            if(nextImmHistPtr != NULL) {
+                sharedTotal += immHistPtr->sharedImmuneAlleleCount(*nextImmHistPtr);
+            }
+        }
+    }
+    
+    AlleleImmunityOverlapRow row;
+    row.time = getTime();
+    row.popId = id;
+    row.meanImmuneAlleles = immuneTotal / double(hosts.size());
+    row.meanSharedImmuneAlleles = sharedTotal / double(hosts.size());
+    simPtr->dbPtr->insert(simPtr->alleleImmunityOverlapTable, row);
 }
 
 void Population::executeMDA(double time)
@@ -335,13 +602,21 @@ void Population::executeMDA(double time)
     size_t totalHosts = binoDist(*rngPtr);
     vector<size_t> hostIndices = drawUniformIndices(
     *rngPtr, hosts.size(), totalHosts, true);
+    // clearances in one MDA round update the biting rates once, at the end
+    deferBiteRateUpdates = true;
     for (size_t index : hostIndices) {
         //only give MDA to hosts whose age is older than 3 months
-        if ((time - simPtr->parPtr->MDA.drugEffDuration - hosts[index]->birthTime)>90) {
-            hosts[index]->MDAEndTime = time;
-            hosts[index]->MDAClearInfection();
+        if ((time - simPtr->parPtr->MDA.drugEffDuration - hosts[index].birthTime)>90) {
+            hosts[index].MDAEndTime = time;
+            if (hosts[index].infectedSetPos >= 0) {
+                hosts[index].MDAClearInfection();
+            }
         }
     }
+    deferBiteRateUpdates = false;
+    if (simPtr->infectiousSourceBiting) {
+        updateBiteEventRates();
+    }
 }
 
 
@@ -366,6 +641,34 @@ void BitingEvent::performEvent(zppsim::EventQueue & queue)
 }
 
 
+/*** BITE BATCH EVENT ***/
+
+BiteBatchEvent::BiteBatchEvent(Population * popPtr, double time) :
+	Event(time),
+	popPtr(popPtr)
+{
+}
+
+void BiteBatchEvent::performEvent(zppsim::EventQueue & queue)
+{
+	popPtr->performBiteBatchEvent();
+}
+
+
+/*** NON-INFECTIOUS BITE EVENT ***/
+
+NonInfectiousBiteEvent::NonInfectiousBiteEvent(Population * popPtr, double rate, zppsim::rng_t & rng) :
+	RateEvent(rate, 0.0, rng),
+	popPtr(popPtr)
+{
+}
+
+void NonInfectiousBiteEvent::performEvent(zppsim::EventQueue & queue)
+{
+	popPtr->performNonInfectiousBiteEvent();
+}
+
+
 /*** IMMIGRATION EVENT ***/
 
 ImmigrationEvent::ImmigrationEvent(Population * popPtr, double rate, zppsim::rng_t & rng) :
@@ -29,6 +29,30 @@ private:
 	Population * popPtr;
 };
 
+// Infectious-source biting: the recorded (subsampled) bites from uninfected
+// hosts, which are not otherwise simulated
+class NonInfectiousBiteEvent : public zppsim::RateEvent
+{
+public:
+	NonInfectiousBiteEvent(Population * popPtr, double rate, zppsim::rng_t & rng);
+	virtual void performEvent(zppsim::EventQueue & queue);
+	
+private:
+	Population * popPtr;
+};
+
+// Batched biting: fires at the time of the next bite in the current batch,
+// or at the end of the batch to draw the next one
+class BiteBatchEvent : public zppsim::Event
+{
+public:
+	BiteBatchEvent(Population * popPtr, double time);
+	virtual void performEvent(zppsim::EventQueue & queue);
+	
+private:
+	Population * popPtr;
+};
+
 class ImmigrationEvent : public zppsim::RateEvent
 {
 public:
@@ -53,11 +77,14 @@ public:
 	int64_t size();
 	
 	Host * getHostAtIndex(int64_t hostIndex);
-	void removeHost(Host * hostPtr);
-	Host * createNewHost();
+	void replaceHost(Host * hostPtr);
+	
+	void updateHostIndexSets(Host & host);
 	
 	double getTime();
 	double getBitingRate();
+	double getTransmittingBiteRate();
+	double getRecordedNonInfectiousBiteRate();
 	double getImmigrationRate();
 	
 	void addEvent(zppsim::Event * event);
@@ -66,12 +93,22 @@ public:
 	void setEventRate(zppsim::RateEvent * event, double rate);
 	
 	void performBitingEvent();
+	void performBiteBatchEvent();
+	void restartBiteBatch();
+	void performNonInfectiousBiteEvent();
 	void performImmigrationEvent();
 	
 	double getDistance(Population * popPtr);
 	
 	void updateRates();
+	void updateBiteEventRates();
 	void sampleHosts();
+	bool verifyState();
+    void sweepImmunity();
+    void compactImmunity();
+    void updateAlleleImmunityCount(AlleleKey key, int64_t delta);
+    void writeAlleleImmunityCoverage();
+    void writeAlleleImmunityOverlap();
     void executeMDA(double time);
 	
 	std::string toString();
@@ -86,12 +123,46 @@ private:
     //record biting rate variation monthly
     std::vector<double> monthlyBitingRateDistribution = parPtr->monthlyBitingRateDistribution.toDoubleVector();
 
-	std::vector<std::unique_ptr<Host>> hosts;
-	std::unordered_map<int64_t, int64_t> hostIdIndexMap;
+	// Hosts in contiguous slots; size is constant and reserved up front,
+	// so Host addresses are stable and a dying host's slot is reused in place
+	std::vector<Host> hosts;
+	
+	// Indices of hosts with at least one infection, and of hosts with at
+	// least one active infection, in no particular order
+	std::vector<int32_t> infectedHostIndices;
+	std::vector<int32_t> activeHostIndices;
+	void updateIndexSet(std::vector<int32_t> & indexSet, int32_t Host::* posField, int32_t hostIndex, bool member);
+	Host * drawBitingSourceHost();
+	Host * getBitingSourceHost(int64_t srcIndex);
+	void performBite(Host * srcHostPtr, Host * dstHostPtr);
+	bool drawMDABlocksBite(Host * dstHostPtr);
+	
+	// Number of hosts immune to each (locus, allele), if tracked
+	std::unordered_map<AlleleKey, int64_t, HashAlleleKey> alleleImmuneHostCounts;
+	
+	// Set while a burst of infection changes (initial infections, an MDA
+	// round) is applied, so that infectious-source bite rates are updated
+	// once afterwards
+	bool deferBiteRateUpdates = false;
 	
 	std::unique_ptr<BitingEvent> bitingEvent;
+	std::unique_ptr<NonInfectiousBiteEvent> nonInfectiousBiteEvent;
 	std::unique_ptr<ImmigrationEvent> immigrationEvent;
 	
+	// Batched biting (biteBatchWindow): bites up to biteBatchEnd, drawn at
+	// biteBatchRate in one pass, replace bitingEvent
+	struct PendingBite
+	{
+		double time;
+		int32_t srcIndex;
+	};
+	std::unique_ptr<BiteBatchEvent> biteBatchEvent;
+	std::vector<PendingBite> biteBatch;
+	size_t nextBite = 0;
+	double biteBatchRate = 0.0;
+	double biteBatchEnd = 0.0;
+	void drawBiteBatch(double startTime);
+	
 	int64_t drawSourcePopulation();
 	
 	int64_t transmissionCount;
@@ -228,6 +228,26 @@ ZPPJSON_DEFINE_TYPE(
      \brief maximum MOI a host can get
      */
     ((Int64)(maxMOI))
+                    
+    /**
+     \brief If true, allele immunity loss times are drawn when immunity is gained
+     or boosted and applied when immunity is next read (or swept, see
+     immunityLossSweepEvery), instead of scheduling one loss event per allele.
+     
+     This is an approximation: an expired allele keeps counting toward
+     the clearance rates of the host's current infections until they are
+     next recomputed (on any infection or immunity change in the host, or by
+     the sweep, which refreshes the rates of hosts it expires entries from).
+     Sweeping more often narrows the lag.
+     */
+    ( (Bool)(useLazyImmunityLoss) )
+                    
+    /**
+     \brief If true and no new alleles can arise (pMutation is zero and no
+     immigration brings new genes), allele immunity membership is also kept
+     as one bitset per host, making immunity checks bit tests.
+     */
+    ( (Bool)(useAlleleBitsets) )
 )
 
 /**
@@ -421,6 +441,31 @@ ZPPJSON_DEFINE_TYPE(
 	*/
 	( (Double)(dbCommitPeriod) )
 	
+	/**
+		\brief Whether to print an estimate of memory use, by kind of object,
+		at each database commit.
+	*/
+	( (Bool)(reportMemoryFootprint) )
+	
+	/**
+		\brief Whether to print, at the end of the run, how many infection
+		rate refreshes batched immunity updates skipped.
+		
+		Only clearances that refresh rates more than once per gene (gene-level
+		immunity, clinical immunity, general immunity) save refreshes; the
+		allele-immunity path never refreshed during the update.
+	*/
+	( (Bool)(reportBatchedImmunityUpdates) )
+	
+	/**
+		\brief Memory budget, in megabytes, for the estimated footprint of
+		simulation objects.
+		
+		Checked at each database commit; if exceeded, the simulation stops
+		with an error and the footprint report. Optional.
+	*/
+	( (Double)(memoryBudgetMB) )
+	
 	/**
 		\brief Random seed for simulation.
 		
@@ -468,11 +513,31 @@ ZPPJSON_DEFINE_TYPE(
 	*/
 	( (Bool)(outputStrains) )
 	
+    /**
+     \brief Whether or not to keep per-population counts of hosts immune to each
+     allele and write them to alleleImmunityCoverage at each host sampling,
+     along with mean repertoire size and host-host overlap to
+     alleleImmunityOverlap
+     */
+    ( (Bool)(outputAlleleImmunityCoverage) )
+	
 	/**
 		\brief How often to sample hosts
 	*/
 	( (Double)(sampleHostsEvery) )
 	
+    /**
+     \brief How often to sweep expired allele immunity from all hosts
+     when withinHost.useLazyImmunityLoss is set
+     */
+    ( (Double)(immunityLossSweepEvery) )
+	
+    /**
+     \brief How often to compact hosts' immune histories (drop expired entries,
+     shrink hash tables and release unused storage); no compaction if absent
+     */
+    ( (Double)(immunityCompactionEvery) )
+	
 	/**
 		\brief How often to sample a transmission event, in number of transmission events.
 	*/
@@ -518,6 +583,18 @@ ZPPJSON_DEFINE_TYPE(
 	*/
 	( (Double)(distancePower) )
 	
+	/**
+		\brief Cutoff distance for the sparse spatial kernel. Optional.
+		
+		If present, populations are binned into square regions of this size.
+		Bite destinations in the source's own and adjacent regions (which
+		include everything within the cutoff) use the exact kernel; more
+		distant populations are reached through a far-field term between
+		region centroids, sampled region -> population. If absent, the full
+		population-by-population kernel is used.
+	*/
+	( (Double)(kernelCutoffDistance) )
+	
 	/**
 		\brief Host-lifetime distribution, specified as a discrete PDF,
 		with uniform density within each discrete chunk
@@ -534,6 +611,31 @@ ZPPJSON_DEFINE_TYPE(
 	*/
 	( (Bool)(coinfectionReducesTransmission) )
 	
+	/**
+		\brief Whether only bites from infected hosts are simulated individually.
+		
+		Bites then occur at the biting rate times the fraction of hosts that
+		are infected, with the source drawn from the infected hosts; this is
+		the same process as drawing sources from all hosts. Bites from
+		uninfected hosts, which cannot transmit, only contribute their
+		(subsampled) records to the EIR output, via a thinned event.
+	*/
+	( (Bool)(infectiousSourceBiting) )
+	
+	/**
+		\brief Length of the window over which bites are generated in one
+		batch. Optional.
+		
+		If present, each population draws the times and source hosts of all
+		its bites for the next window at once and performs them in time
+		order, interleaved with other events; destinations are drawn as each
+		bite happens. A population's batch is redrawn from the current time
+		when a rate update changes its biting rate, so the window must be
+		shorter than seasonalUpdateEvery (ideally a divisor of it). Not
+		compatible with infectiousSourceBiting.
+	*/
+	( (Double)(biteBatchWindow) )
+	
 	/**
 		\brief Parameters governing within-host dynamics
 		(see WithinHostParameters class).
@@ -565,6 +667,17 @@ ZPPJSON_DEFINE_TYPE(
 	*/
 	( (Bool)(trackClinicalImmunity) )
                     
+	/**
+		\brief Whether a host's immune history is allocated only once it gains
+		immunity, and freed again once the host has no infections and no
+		immunity left.
+		
+		Every host keeps its fixed-size record (infection slots, death event,
+		index-set positions); only the immune histories, which hold the
+		per-host hash maps, scale with the immune population.
+	*/
+	( (Bool)(materializeHostsLazily) )
+                    
     /**
      \brief Probability of microsatellites mutation, per gene, per day
      */
@@ -9,6 +9,7 @@
 #include <string>
 #include <fstream>
 #include <iterator>
+#include <map>
 
 // 100-millisecond delay between database commit retries
 #define DB_RETRY_DELAY 100000
@@ -46,6 +47,7 @@ Simulation::Simulation(SimParameters * parPtr, Database * dbPtr) :
 		parPtr->hostLifetimeDistribution.x0,
 		parPtr->hostLifetimeDistribution.dx.toDoubleVector()
 	),
+	withinHostRates(parPtr),
 	queuePtr(new EventQueue(rng)),
 	rateUpdateEvent(this, 0.0, parPtr->seasonalUpdateEvery),
 	hostStateSamplingEvent(this, parPtr->burnIn, parPtr->sampleHostsEvery),
@@ -62,6 +64,8 @@ Simulation::Simulation(SimParameters * parPtr, Database * dbPtr) :
 	hostsTable("hosts"),
     microsatTable("microsats"),
     alleleImmunityTable("hostsAlleleImmunityHistory"),
+    alleleImmunityCoverageTable("alleleImmunityCoverage"),
+    alleleImmunityOverlapTable("alleleImmunityOverlap"),
     InfectionDurationTable("InfectionDuration"),
     recordEIRTable("recordEIR"),
     sampledHostsTable("sampledHosts"),
@@ -95,6 +99,34 @@ Simulation::Simulation(SimParameters * parPtr, Database * dbPtr) :
     //make sure burnin time is smaller than end time
     assert(parPtr->burnIn<parPtr->tEnd);
     
+    if(parPtr->biteBatchWindow.present()) {
+        if(infectiousSourceBiting) {
+            throw std::runtime_error("biteBatchWindow cannot be combined with infectiousSourceBiting");
+        }
+        if(!(parPtr->biteBatchWindow > 0.0)) {
+            throw std::runtime_error("biteBatchWindow must be positive");
+        }
+        // a batch is redrawn at each rate update that changes the biting
+        // rate, so windows reaching past the next update would be wasted
+        if(!(parPtr->biteBatchWindow < parPtr->seasonalUpdateEvery)) {
+            throw std::runtime_error("biteBatchWindow must be shorter than seasonalUpdateEvery");
+        }
+    }
+    
+    // infections store gene indices in 16 bits (see WAITING_STAGE)
+    if(parPtr->genesPerStrain >= WAITING_STAGE) {
+        throw std::runtime_error("genesPerStrain too large for 16-bit gene indices");
+    }
+    
+	// Transmission scratch buffers; they grow past these sizes if needed
+	int64_t maxMOI = parPtr->withinHost.maxMOI;
+	originalStrainsScratch.reserve(maxMOI);
+	originalMSScratch.reserve(maxMOI);
+	transmittedStrainsScratch.reserve(maxMOI);
+	transmittedMSScratch.reserve(maxMOI);
+	strainGenesScratch.reserve(parPtr->genesPerStrain);
+	msAllelesScratch.reserve(microsatNumber);
+	
 	queuePtr->addEvent(&rateUpdateEvent);
 	queuePtr->addEvent(&hostStateSamplingEvent);
     if (parPtr->MDA.includeMDA) queuePtr->addEvent(&mdaEvent);
@@ -102,6 +134,18 @@ Simulation::Simulation(SimParameters * parPtr, Database * dbPtr) :
         queuePtr->addEvent(&irsEvent);
         queuePtr->addEvent(&removeirsEvent);
     };
+    if (lazyImmunityLoss && parPtr->immunityLossSweepEvery.present()) {
+        immunitySweepEvent = unique_ptr<ImmunitySweepEvent>(
+            new ImmunitySweepEvent(this, parPtr->immunityLossSweepEvery, parPtr->immunityLossSweepEvery)
+        );
+        queuePtr->addEvent(immunitySweepEvent.get());
+    }
+    if (parPtr->immunityCompactionEvery.present()) {
+        immunityCompactionEvent = unique_ptr<ImmunityCompactionEvent>(
+            new ImmunityCompactionEvent(this, parPtr->immunityCompactionEvery, parPtr->immunityCompactionEvery)
+        );
+        queuePtr->addEvent(immunityCompactionEvent.get());
+    }
     
     //create variant size for each locus
     Array<Double> vals = parPtr->genes.alleleNumber;
@@ -117,6 +161,7 @@ Simulation::Simulation(SimParameters * parPtr, Database * dbPtr) :
         }
 	}
     assert(alleleNumber.size()==size_t(locusNumber));
+    initializeAlleleBitLayout();
     
 	// Create gene pool
 	genes.reserve(parPtr->genePoolSize);
@@ -186,6 +231,8 @@ Simulation::Simulation(SimParameters * parPtr, Database * dbPtr) :
 	for(int64_t popId = 0; popId < parPtr->populations.size(); popId++) {
 		popPtrs.emplace_back(new Population(this, popId));
 	}
+	initializeDistanceKernel();
+	updateDestinationTables();
 	
 	dbPtr->commitWithRetry(DB_RETRY_DELAY, DB_TIMEOUT, cerr);
 	
@@ -225,6 +272,31 @@ void Simulation::runMSSimCoal(size_t msSampleSize) {
     system((char *)temp);
 }
 
+void Simulation::initializeAlleleBitLayout()
+{
+    if(!(parPtr->withinHost.useAlleleBitsets.present() && parPtr->withinHost.useAlleleBitsets)) {
+        return;
+    }
+    
+    // bitsets need a bounded allele space; new alleles only come from
+    // mutateGene, which also drops the layout if capacity is exceeded
+    // (e.g. by new genes brought in by immigration)
+    bool bounded = parPtr->pMutation == 0.0;
+    if(!bounded) {
+        cerr << "useAlleleBitsets ignored: new alleles can arise; using hashed allele immunity" << '\n';
+        return;
+    }
+    
+    alleleBitLayout.alleleCapacity = alleleNumber;
+    alleleBitLayout.wordOffsets.resize(locusNumber);
+    alleleBitLayout.wordCount = 0;
+    for(size_t i = 0; i < locusNumber; i++) {
+        alleleBitLayout.wordOffsets[i] = alleleBitLayout.wordCount;
+        alleleBitLayout.wordCount += (alleleNumber[i] + 63) / 64;
+    }
+    alleleBitLayout.active = true;
+}
+
 GenePtr Simulation::createGene(std::vector<int64_t> Alleles,bool const functionality,int64_t const source)
 {
 	assert(parPtr->genes.transmissibility.size() == 1);
@@ -257,6 +329,8 @@ void Simulation::initializeDatabaseTables()
 	dbPtr->createTable(strainsTable);
 	dbPtr->createTable(hostsTable);
 	dbPtr->createTable(alleleImmunityTable);
+	dbPtr->createTable(alleleImmunityCoverageTable);
+	dbPtr->createTable(alleleImmunityOverlapTable);
 	dbPtr->createTable(sampledHostsTable);
 	dbPtr->createTable(sampledHostInfectionTable);
 	dbPtr->createTable(sampledHostImmunityTable);
@@ -292,10 +366,35 @@ void Simulation::run()
 		}
 		dbPtr->commitWithRetry(DB_RETRY_DELAY, DB_TIMEOUT, cerr);
 		cerr << "Committed at t = " << getTime() << '\n';
+		assert(verifyState());
+		
+		bool reportMemory = parPtr->reportMemoryFootprint.present() && parPtr->reportMemoryFootprint;
+		if(reportMemory || parPtr->memoryBudgetMB.present()) {
+			MemoryFootprint footprint = measureMemoryFootprint();
+			if(reportMemory) {
+				footprint.write(cerr);
+			}
+			if(parPtr->memoryBudgetMB.present()
+				&& footprint.totalBytes() > parPtr->memoryBudgetMB * 1024.0 * 1024.0
+			) {
+				if(!reportMemory) {
+					footprint.write(cerr);
+				}
+				stringstream ss;
+				ss << "estimated memory footprint (" << footprint.totalBytes() / (1024 * 1024)
+					<< " MB) exceeds memoryBudgetMB (" << double(parPtr->memoryBudgetMB)
+					<< ") at t = " << getTime();
+				throw std::runtime_error(ss.str());
+			}
+		}
 	}
 	
 	cout << "Total event count: " << queuePtr->getEventCount() << '\n';
 	cout << "Transmission count: " << transmissionCount << '\n';
+	if(parPtr->reportBatchedImmunityUpdates.present() && parPtr->reportBatchedImmunityUpdates) {
+		cerr << "Immunity rate refreshes skipped: " << deferredRateRefreshCount
+			<< " (" << deferredRateUpdateCount << " event rate updates)" << '\n';
+	}
 	
 	time_t endTime = time(nullptr);
 	clock_t endClock = clock();
@@ -307,6 +406,135 @@ void Simulation::run()
 	fprintf(stderr, "Memory usage: %ld\n", resourceUsage.ru_maxrss);
 }
 
+// Approximate bytes held by a node-based hash container: nodes (value plus
+// next pointer and cached hash) and the bucket array
+template<typename HashContainer>
+static int64_t hashContainerBytes(HashContainer & c)
+{
+	return c.size() * (sizeof(typename HashContainer::value_type) + 2 * sizeof(void *))
+		+ c.bucket_count() * sizeof(void *);
+}
+
+void Simulation::addImmuneHistoryFootprint(ImmuneHistory & immHist, MemoryFootprint & fp)
+{
+	fp.immuneHistories.count++;
+	fp.immuneHistories.bytes += sizeof(ImmuneHistory)
+		+ hashContainerBytes(immHist.immuneAlleles)
+		+ hashContainerBytes(immHist.genes)
+		+ hashContainerBytes(immHist.lossEvents)
+		+ hashContainerBytes(immHist.geneImmunityCache)
+		+ immHist.immuneAlleleBits.capacity() * sizeof(uint64_t);
+	fp.immuneEntries.count += immHist.immuneAlleles.size() + immHist.genes.size();
+	
+	fp.immunityLossEvents.count += immHist.lossEvents.size();
+	fp.immunityLossEvents.bytes += immHist.lossEvents.size() * sizeof(ImmunityLossEvent);
+	for(auto & kv : immHist.immuneAlleles) {
+		if(kv.second.lossEvent) {
+			fp.immunityLossEvents.count++;
+			fp.immunityLossEvents.bytes += sizeof(AlleleImmuneLossEvent);
+		}
+	}
+}
+
+MemoryFootprint Simulation::measureMemoryFootprint()
+{
+	MemoryFootprint fp;
+	
+	for(auto & popPtr : popPtrs) {
+		fp.hosts.count += popPtr->hosts.size();
+		fp.hosts.bytes += popPtr->hosts.capacity() * sizeof(Host)
+			+ (popPtr->infectedHostIndices.capacity() + popPtr->activeHostIndices.capacity()) * sizeof(int32_t);
+		fp.deathEvents.count += popPtr->hosts.size();
+		fp.deathEvents.bytes += popPtr->hosts.size() * sizeof(DeathEvent);
+		
+		for(auto & host : popPtr->hosts) {
+			fp.infections.count += host.infections.size();
+			fp.infections.bytes += host.infections.capacity() * InfectionStore::slotSize();
+			for(auto & infection : host.infections) {
+				fp.infections.bytes += infection.expressionOrder.capacity() * sizeof(int16_t);
+				int64_t nEvents = (infection.transitionEvent ? 1 : 0)
+					+ (infection.clearanceEvent ? 1 : 0)
+					+ (infection.mutationEvent ? 1 : 0)
+					+ (infection.recombinationEvent ? 1 : 0)
+					+ (infection.msMutationEvent ? 1 : 0);
+				fp.infectionEvents.count += nEvents;
+				fp.infectionEvents.bytes += nEvents * sizeof(InfectionProcessEvent);
+			}
+			
+			if(host.immunity) {
+				addImmuneHistoryFootprint(*host.immunity, fp);
+			}
+			if(host.clinicalImmunity) {
+				addImmuneHistoryFootprint(*host.clinicalImmunity, fp);
+			}
+		}
+	}
+	
+	for(auto & genesPtr : { &genes, &microsats }) {
+		for(auto & genePtr : *genesPtr) {
+			fp.genes.count++;
+			fp.genes.bytes += sizeof(Gene) + genePtr->Alleles.capacity() * sizeof(int64_t);
+		}
+	}
+	
+	fp.strains.count = strains.size();
+	fp.strains.bytes = strains.capacity() * sizeof(StrainPtr) + hashContainerBytes(strainPtrToIndexMap);
+	for(auto & strainPtr : strains) {
+		fp.strains.bytes += sizeof(Strain) + strainPtr->genes.capacity() * sizeof(GenePtr);
+	}
+	
+	fp.strainMapKeys.count = strainHashToIndexMap.size();
+	fp.strainMapKeys.bytes = hashContainerBytes(strainHashToIndexMap);
+	
+	for(auto & kernels : { &nearKernel, &farKernel }) {
+		for(auto & kernel : *kernels) {
+			fp.spatialKernel.count += kernel.size();
+			fp.spatialKernel.bytes += kernel.capacity() * sizeof(KernelEntry);
+		}
+	}
+	for(auto & tables : { &nearTables, &farTables, &regionTables }) {
+		for(auto & table : *tables) {
+			fp.spatialKernel.bytes += table.size() * (sizeof(double) + sizeof(size_t));
+		}
+	}
+	
+	return fp;
+}
+
+int64_t MemoryFootprint::totalBytes()
+{
+	return hosts.bytes + infections.bytes + infectionEvents.bytes + deathEvents.bytes
+		+ immuneHistories.bytes + immunityLossEvents.bytes
+		+ genes.bytes + strains.bytes + strainMapKeys.bytes + spatialKernel.bytes;
+}
+
+void MemoryFootprint::write(std::ostream & os)
+{
+	os << "Memory footprint (count, bytes):" << '\n';
+	os << "  hosts: " << hosts.count << ", " << hosts.bytes << '\n';
+	os << "  infections: " << infections.count << ", " << infections.bytes << '\n';
+	os << "  infection events: " << infectionEvents.count << ", " << infectionEvents.bytes << '\n';
+	os << "  death events: " << deathEvents.count << ", " << deathEvents.bytes << '\n';
+	os << "  immune histories: " << immuneHistories.count << ", " << immuneHistories.bytes << '\n';
+	os << "  immune entries: " << immuneEntries.count << " (in immune histories)" << '\n';
+	os << "  immunity loss events: " << immunityLossEvents.count << ", " << immunityLossEvents.bytes << '\n';
+	os << "  genes: " << genes.count << ", " << genes.bytes << '\n';
+	os << "  strains: " << strains.count << ", " << strains.bytes << '\n';
+	os << "  strain map keys: " << strainMapKeys.count << ", " << strainMapKeys.bytes << '\n';
+	os << "  spatial kernel: " << spatialKernel.count << ", " << spatialKernel.bytes << '\n';
+	os << "  total bytes: " << totalBytes() << '\n';
+}
+
+bool Simulation::verifyState()
+{
+	for(auto & popPtr : popPtrs) {
+		if(!popPtr->verifyState()) {
+			return false;
+		}
+	}
+	return true;
+}
+
 void Simulation::runUntil(double time)
 {
 	while(queuePtr->getNextTime() <= time) {
@@ -359,25 +587,168 @@ double Simulation::distanceWeightFunction(double d)
 	return pow(d, -parPtr->distancePower);
 }
 
-Host * Simulation::drawDestinationHost(int64_t srcPopId)
+void Simulation::initializeDistanceKernel()
+{
+	if(parPtr->kernelCutoffDistance.present()) {
+		initializeSparseDistanceKernel(parPtr->kernelCutoffDistance);
+		return;
+	}
+	
+	nearKernel.assign(popPtrs.size(), vector<KernelEntry>(popPtrs.size()));
+	for(size_t srcPopId = 0; srcPopId < popPtrs.size(); srcPopId++) {
+		for(size_t dstPopId = 0; dstPopId < popPtrs.size(); dstPopId++) {
+			double dist = popPtrs[srcPopId]->getDistance(popPtrs[dstPopId].get());
+			nearKernel[srcPopId][dstPopId] = { dstPopId, distanceWeightFunction(dist) };
+		}
+	}
+}
+
+// Bins populations into a grid of square regions with side `cutoff`.
+// Any two populations within `cutoff` of each other lie in the same or
+// adjacent regions, so those are kept as the exact near field; all other
+// regions are far field, weighted by the kernel between region centroids.
+void Simulation::initializeSparseDistanceKernel(double cutoff)
+{
+	if(!(cutoff > 0.0)) {
+		throw std::runtime_error("kernelCutoffDistance must be positive");
+	}
+	
+	map<pair<int64_t, int64_t>, size_t> cellToRegion;
+	vector<pair<int64_t, int64_t>> regionCells;
+	vector<pair<double, double>> centroids;
+	popRegions.resize(popPtrs.size());
+	for(size_t popId = 0; popId < popPtrs.size(); popId++) {
+		double x = parPtr->populations[popId].x;
+		double y = parPtr->populations[popId].y;
+		pair<int64_t, int64_t> cell(int64_t(floor(x / cutoff)), int64_t(floor(y / cutoff)));
+		auto itr = cellToRegion.find(cell);
+		if(itr == cellToRegion.end()) {
+			itr = cellToRegion.insert(make_pair(cell, regionCells.size())).first;
+			regionCells.push_back(cell);
+			regionMembers.emplace_back();
+			centroids.emplace_back(0.0, 0.0);
+		}
+		size_t regionId = itr->second;
+		popRegions[popId] = regionId;
+		regionMembers[regionId].push_back(popId);
+		centroids[regionId].first += x;
+		centroids[regionId].second += y;
+	}
+	for(size_t regionId = 0; regionId < regionCells.size(); regionId++) {
+		centroids[regionId].first /= regionMembers[regionId].size();
+		centroids[regionId].second /= regionMembers[regionId].size();
+	}
+	
+	// Regions adjacent to (or equal to) each region, via the cell lookup
+	vector<vector<size_t>> neighborRegions(regionCells.size());
+	for(size_t regionId = 0; regionId < regionCells.size(); regionId++) {
+		for(int64_t dx = -1; dx <= 1; dx++) {
+			for(int64_t dy = -1; dy <= 1; dy++) {
+				auto itr = cellToRegion.find(make_pair(
+					regionCells[regionId].first + dx, regionCells[regionId].second + dy
+				));
+				if(itr != cellToRegion.end()) {
+					neighborRegions[regionId].push_back(itr->second);
+				}
+			}
+		}
+		sort(neighborRegions[regionId].begin(), neighborRegions[regionId].end());
+	}
+	
+	nearKernel.assign(popPtrs.size(), vector<KernelEntry>());
+	for(size_t srcPopId = 0; srcPopId < popPtrs.size(); srcPopId++) {
+		for(size_t regionId : neighborRegions[popRegions[srcPopId]]) {
+			for(size_t dstPopId : regionMembers[regionId]) {
+				double dist = popPtrs[srcPopId]->getDistance(popPtrs[dstPopId].get());
+				nearKernel[srcPopId].push_back({ dstPopId, distanceWeightFunction(dist) });
+			}
+		}
+	}
+	
+	farKernel.assign(regionCells.size(), vector<KernelEntry>());
+	for(size_t srcRegionId = 0; srcRegionId < regionCells.size(); srcRegionId++) {
+		auto & neighbors = neighborRegions[srcRegionId];
+		for(size_t dstRegionId = 0; dstRegionId < regionCells.size(); dstRegionId++) {
+			if(binary_search(neighbors.begin(), neighbors.end(), dstRegionId)) {
+				continue;
+			}
+			double xDiff = centroids[srcRegionId].first - centroids[dstRegionId].first;
+			double yDiff = centroids[srcRegionId].second - centroids[dstRegionId].second;
+			double dist = sqrt(xDiff*xDiff + yDiff*yDiff);
+			farKernel[srcRegionId].push_back({ dstRegionId, distanceWeightFunction(dist) });
+		}
+	}
+}
+
+// Rebuilds the destination alias tables from current biting rates;
+// biting rates only change in updateRates, IRS and RemoveIRS
+void Simulation::updateDestinationTables()
 {
-	Population * srcPopPtr = popPtrs[srcPopId].get();
+	vector<double> dstWeights(popPtrs.size());
+	for(size_t dstPopId = 0; dstPopId < popPtrs.size(); dstPopId++) {
+		dstWeights[dstPopId] = popPtrs[dstPopId]->getBitingRate() * popPtrs[dstPopId]->size();
+	}
 	
 	vector<double> weights;
-	for(auto & popPtr : popPtrs) {
-		double dist = srcPopPtr->getDistance(popPtr.get());
-		weights.push_back(
-			distanceWeightFunction(dist)
-			* popPtr->getBitingRate()
-			* popPtr->size()
-		);
+	nearTables.clear();
+	nearTables.reserve(popPtrs.size());
+	nearTotals.assign(popPtrs.size(), 0.0);
+	for(size_t srcPopId = 0; srcPopId < popPtrs.size(); srcPopId++) {
+		weights.clear();
+		for(auto & entry : nearKernel[srcPopId]) {
+			weights.push_back(entry.weight * dstWeights[entry.index]);
+			nearTotals[srcPopId] += weights.back();
+		}
+		nearTables.emplace_back(weights);
+	}
+	
+	// Far field: populations within each region, then regions from each region
+	vector<double> regionWeights(regionMembers.size(), 0.0);
+	regionTables.clear();
+	regionTables.reserve(regionMembers.size());
+	for(size_t regionId = 0; regionId < regionMembers.size(); regionId++) {
+		weights.clear();
+		for(size_t popId : regionMembers[regionId]) {
+			weights.push_back(dstWeights[popId]);
+			regionWeights[regionId] += dstWeights[popId];
+		}
+		regionTables.emplace_back(weights);
+	}
+	farTables.clear();
+	farTables.reserve(farKernel.size());
+	farTotals.assign(farKernel.size(), 0.0);
+	for(size_t srcRegionId = 0; srcRegionId < farKernel.size(); srcRegionId++) {
+		weights.clear();
+		for(auto & entry : farKernel[srcRegionId]) {
+			weights.push_back(entry.weight * regionWeights[entry.index]);
+			farTotals[srcRegionId] += weights.back();
+		}
+		farTables.emplace_back(weights);
 	}
-	int64_t dstPopId = sampleDiscreteLinearSearch(rng, weights);
-	Population * dstPopPtr = popPtrs[dstPopId].get();
+}
+
+Host * Simulation::drawDestinationHost(int64_t srcPopId)
+{
+	Population * dstPopPtr = popPtrs[drawDestinationPopulation(srcPopId)].get();
 	int64_t dstHostIndex = drawUniformIndex(rng, dstPopPtr->size());
 	return dstPopPtr->getHostAtIndex(dstHostIndex);
 }
 
+int64_t Simulation::drawDestinationPopulation(int64_t srcPopId)
+{
+	size_t dstPopId;
+	double farTotal = popRegions.empty() ? 0.0 : farTotals[popRegions[srcPopId]];
+	if(farTotal > 0.0 && uniform_real_distribution<>(0.0, nearTotals[srcPopId] + farTotal)(rng) >= nearTotals[srcPopId]) {
+		size_t srcRegionId = popRegions[srcPopId];
+		size_t dstRegionId = farKernel[srcRegionId][farTables[srcRegionId].draw(rng)].index;
+		dstPopId = regionMembers[dstRegionId][regionTables[dstRegionId].draw(rng)];
+	}
+	else {
+		dstPopId = nearKernel[srcPopId][nearTables[srcPopId].draw(rng)].index;
+	}
+	return dstPopId;
+}
+
 StrainPtr Simulation::generateRandomStrain()
 {
 	int64_t genesPerStrain = parPtr->genesPerStrain;
@@ -427,25 +798,54 @@ StrainPtr Simulation::recombineStrains(StrainPtr const & s1, StrainPtr const & s
 {
 	assert(s1->size() == s2->size());
 	
-	// Draw random subset of two strains
-	vector<GenePtr> allGenes;
-	allGenes.reserve(s1->size() + s2->size());
-	copy(s1->genes.begin(), s1->genes.end(), std::back_inserter(allGenes));
-	copy(s2->genes.begin(), s2->genes.end(), std::back_inserter(allGenes));
-	assert(allGenes.size() == s1->size() + s2->size());
+	vector<GenePtr> & daughterGenes = strainGenesScratch;
+	size_t hashVal = sampleRecombinantGenes(rng, s1->genes, s2->genes, daughterGenes);
+	assert(hashVal == hashGenePtrVec(daughterGenes));
 	
-	vector<size_t> daughterIndices = drawUniformIndices(rng, allGenes.size(), size_t(s1->size()), false);
-	vector<GenePtr> daughterGenes(daughterIndices.size());
-	for(size_t i = 0; i < daughterIndices.size(); i++) {
-		daughterGenes[i] = allGenes[daughterIndices[i]];
-	}
+	return getStrainSorted(daughterGenes, hashVal);
+}
+
+// Selection sampling (Knuth's algorithm S) over the parents' sorted genes
+// merged in order: each gene is kept with probability (genes still needed) /
+// (genes still unseen), which draws a uniform subset of genes1.size() of the
+// pooled genes. The daughter's genes come out sorted, as strains store them,
+// and are hashed as they are chosen; returns HashGenePtrVec of the result.
+size_t Simulation::sampleRecombinantGenes(
+	zppsim::rng_t & rng,
+	std::vector<GenePtr> const & genes1, std::vector<GenePtr> const & genes2,
+	std::vector<GenePtr> & daughterGenes
+)
+{
+	assert(genes1.size() == genes2.size());
+	assert(std::is_sorted(genes1.begin(), genes1.end()));
+	assert(std::is_sorted(genes2.begin(), genes2.end()));
 	
-	return getStrain(daughterGenes);
+	HashGenePtrVec hashGenePtrVec;
+	size_t nGenes = genes1.size();
+	daughterGenes.clear();
+	size_t hashVal = 0;
+	size_t i1 = 0;
+	size_t i2 = 0;
+	size_t nUnseen = 2 * nGenes;
+	while(daughterGenes.size() < nGenes) {
+		bool fromFirst = i2 == nGenes || (i1 < nGenes && genes1[i1] < genes2[i2]);
+		GenePtr const & genePtr = fromFirst ? genes1[i1++] : genes2[i2++];
+		if(size_t(drawUniformIndex(rng, nUnseen)) < nGenes - daughterGenes.size()) {
+			if(daughterGenes.empty()) {
+				hashVal = hashGenePtrVec.begin(genePtr);
+			}
+			hashVal = hashGenePtrVec.add(hashVal, genePtr);
+			daughterGenes.push_back(genePtr);
+		}
+		nUnseen--;
+	}
+	return hashVal;
 }
 
 GenePtr Simulation::recombineMS(GenePtr const & ms1, GenePtr const & ms2)
 {
-    vector<int64_t> newMS = ms1->Alleles;
+    vector<int64_t> & newMS = msAllelesScratch;
+    newMS.assign(ms1->Alleles.begin(), ms1->Alleles.end());
     for (size_t i=0; i<ms1->Alleles.size(); ++i) {
         if (drawUniformIndex(rng,2) == 1) {
             newMS[i] = ms2->Alleles[i];
@@ -542,6 +942,7 @@ void Simulation::updateRates()
 	for(auto & popPtr : popPtrs) {
 		popPtr->updateRates();
 	}
+	updateDestinationTables();
 }
 
 void Simulation::sampleHosts()
@@ -555,6 +956,20 @@ void Simulation::sampleHosts()
     //}
 }
 
+void Simulation::sweepImmunity()
+{
+    for(auto & popPtr : popPtrs) {
+        popPtr->sweepImmunity();
+    }
+}
+
+void Simulation::compactImmunity()
+{
+    for(auto & popPtr : popPtrs) {
+        popPtr->compactImmunity();
+    }
+}
+
 void Simulation::MDA()
 {
     double t = getTime();
@@ -583,6 +998,7 @@ void Simulation::IRS()
         popPtr->IRSBitingAmplitude = parPtr->intervention.amplitude;
         popPtr->setEventRate(popPtr->immigrationEvent.get(),popPtr->getImmigrationRate()*parPtr->intervention.IRSMRateAmplitude);
     }
+    updateDestinationTables();
     
 }
 
@@ -594,14 +1010,15 @@ void Simulation::RemoveIRS()
         popPtr->IRSBitingAmplitude = 1;
         popPtr->setEventRate(popPtr->immigrationEvent.get(),popPtr->getImmigrationRate());
     }
+    updateDestinationTables();
 }
 
-void Simulation::recordImmunity(Host & host, int64_t locusIndex, int64_t alleleId) {
+void Simulation::recordImmunity(Host & host, AlleleKey key) {
     AlleleImmunityRow row;
     row.time = getTime();
     row.hostId = host.id;
-    row.locusIndex = locusIndex;
-    row.alleleId = alleleId;
+    row.locusIndex = key.locusId();
+    row.alleleId = key.alleleId();
     dbPtr->insert(alleleImmunityTable,row);
 }
 
@@ -637,42 +1054,42 @@ void Simulation::recordTransmission(Host &srcHost, Host &dstHost, std::vector<St
 	transmissionCount++;
 }
 
-void Simulation::writeDuration(std::list<Infection>::iterator infectionItr)
+void Simulation::writeDuration(Infection & infection)
 {
     bernoulli_distribution flipCoin(0.001);
     if(flipCoin(rng)) {
         InfectionDurationRow row;
-        row.time = infectionItr->initialTime;
-        row.duration = getTime() - infectionItr->initialTime;
-        row.hostId = infectionItr->hostPtr->id;
-        row.infectionId = infectionItr->id;
+        row.time = infection.initialTime;
+        row.duration = getTime() - infection.initialTime;
+        row.hostId = infection.hostPtr->id;
+        row.infectionId = infection.id;
         dbPtr->insert(InfectionDurationTable, row);
     }
 }
 
-void Simulation::writeFollowedHostInfection(std::list<Infection>::iterator infectionItr)
+void Simulation::writeFollowedHostInfection(Infection & infection)
 {
     if (parPtr->following.includeHostFollowing) {
-        if (infectionItr->hostPtr->toTrack) {
+        if (infection.hostPtr->toTrack) {
             followedHostsRow row;
-            row.time = infectionItr->initialTime;
-            row.duration = getTime()-infectionItr->initialTime;
-            row.hostId = infectionItr->hostPtr->id;
-            row.infectionId = infectionItr->id;
-            row.popId = infectionItr->hostPtr->popPtr->id;
-            row.strainId = infectionItr->strainPtr->id;
-            double t = getTime() - infectionItr->hostPtr->birthTime;
+            row.time = infection.initialTime;
+            row.duration = getTime()-infection.initialTime;
+            row.hostId = infection.hostPtr->id;
+            row.infectionId = infection.id;
+            row.popId = infection.hostPtr->popPtr->id;
+            row.strainId = infection.strainPtr->id;
+            double t = getTime() - infection.hostPtr->birthTime;
             
             //if time surpass the tracking period
             if (t > parPtr->following.followDuration) {
                // cout<<"it's larger"<<t<<endl;
                 
-                infectionItr->hostPtr->toTrack = false;
+                infection.hostPtr->toTrack = false;
                 
             }else{
                 //cout<<"it's within duration"<<t<<endl;
                 dbPtr->insert(followedHostsTable, row);
-                infectionItr->strainPtr->writeToDatabaseStrain(*dbPtr, strainsTable, genesTable, lociTable);
+                infection.strainPtr->writeToDatabaseStrain(*dbPtr, strainsTable, genesTable, lociTable);
             }
             
 
@@ -680,18 +1097,31 @@ void Simulation::writeFollowedHostInfection(std::list<Infection>::iterator infec
     }
 }
 
+void Simulation::countDeferredRateRefresh(int64_t nStartedInfections)
+{
+    // each refresh updates the clearance and transition rates of every
+    // infection past the liver stage
+    deferredRateRefreshCount++;
+    deferredRateUpdateCount += 2 * nStartedInfections;
+}
+
 void Simulation::writeEIR(double time, int64_t infectious)
 {
-    bernoulli_distribution flipCoin(0.001);
+    bernoulli_distribution flipCoin(EIR_SAMPLING_PROBABILITY);
     if(flipCoin(rng)) {
-        recordEIRRow row;
-        row.time = time;
-        row.infectious = infectious;
-        dbPtr->insert(recordEIRTable, row);
+        insertEIRRow(time, infectious);
     }
     
 }
 
+void Simulation::insertEIRRow(double time, int64_t infectious)
+{
+    recordEIRRow row;
+    row.time = time;
+    row.infectious = infectious;
+    dbPtr->insert(recordEIRTable, row);
+}
+
 
 
 //for immigration events, only sample from the large pool that exists
@@ -727,6 +1157,11 @@ GenePtr Simulation::mutateGene(GenePtr const & srcGenePtr, int64_t const source)
     }
     //mutate allele
     alleleNumber[mutateLocusId]++;
+    if(alleleBitLayout.active && alleleNumber[mutateLocusId] > alleleBitLayout.alleleCapacity[mutateLocusId]) {
+        // allele space no longer bounded: fall back to hashed immunity
+        cerr << "new allele exceeds bitset capacity; disabling allele bitsets" << '\n';
+        alleleBitLayout.active = false;
+    }
     std::vector<int64_t> newLoci = srcLociAlleles;
     newLoci[mutateLocusId] = alleleNumber[mutateLocusId]-1;
     //cout<<newLoci[mutateLocusId]<<endl;
@@ -749,7 +1184,7 @@ GenePtr Simulation::mutateMS(GenePtr const & srcMS) {
 //test whether a new allele vector already exist in the genes allele vectors
 //return the id number of the vector, all the new gene id
 int64_t Simulation::recLociId(std::vector<int64_t> & recGeneAlleles, std::vector<GenePtr> & searchSet) {
-    for (GenePtr j : searchSet) {
+    for (auto & j : searchSet) {
         if (recGeneAlleles == j->Alleles) {
             return j->id;
         }
@@ -867,21 +1302,26 @@ GenePtr Simulation::mutateGene(GenePtr const & srcGenePtr) {
 
 StrainPtr Simulation::getStrain(std::vector<GenePtr> const & oriStrainGenes)
 {
-	StrainPtr strainPtr;
-    std::vector<GenePtr> strainGenes = oriStrainGenes;
+    std::vector<GenePtr> & strainGenes = strainGenesScratch;
+    strainGenes.assign(oriStrainGenes.begin(), oriStrainGenes.end());
     std::sort (strainGenes.begin(),strainGenes.end());
+    return getStrainSorted(strainGenes, hashGenePtrVec(strainGenes));
+}
 
-	auto strainItr = geneVecToStrainIndexMap.find(strainGenes);
-	if(strainItr == geneVecToStrainIndexMap.end()) {
-		strains.emplace_back(new Strain(nextStrainId++, strainGenes,parPtr->outputStrains,*dbPtr, strainsTable));
-		strainPtr = strains.back();
-		geneVecToStrainIndexMap[strainGenes] = strains.size() - 1;
-		
-	}
-	else {
-		strainPtr = strains[strainItr->second];
+StrainPtr Simulation::getStrainSorted(std::vector<GenePtr> const & sortedGenes, size_t hashVal)
+{
+	assert(std::is_sorted(sortedGenes.begin(), sortedGenes.end()));
+	
+	auto range = strainHashToIndexMap.equal_range(hashVal);
+	for(auto strainItr = range.first; strainItr != range.second; ++strainItr) {
+		if(strains[strainItr->second]->genes == sortedGenes) {
+			return strains[strainItr->second];
+		}
 	}
-	return strainPtr;
+	
+	strains.emplace_back(new Strain(nextStrainId++, sortedGenes,parPtr->outputStrains,*dbPtr, strainsTable));
+	strainHashToIndexMap.emplace(hashVal, strains.size() - 1);
+	return strains.back();
 }
 
 
@@ -905,6 +1345,26 @@ void HostStateSamplingEvent::performEvent(zppsim::EventQueue & queue)
 	simPtr->sampleHosts();
 }
 
+ImmunitySweepEvent::ImmunitySweepEvent(Simulation * simPtr, double initialTime, double period):
+    PeriodicEvent(initialTime,period),simPtr(simPtr)
+{
+}
+
+void ImmunitySweepEvent::performEvent(zppsim::EventQueue & queue)
+{
+    simPtr->sweepImmunity();
+}
+
+ImmunityCompactionEvent::ImmunityCompactionEvent(Simulation * simPtr, double initialTime, double period):
+    PeriodicEvent(initialTime,period),simPtr(simPtr)
+{
+}
+
+void ImmunityCompactionEvent::performEvent(zppsim::EventQueue & queue)
+{
+    simPtr->compactImmunity();
+}
+
 //add MDA events to simulate giving drugs to all hosts
 MDAEvent::MDAEvent(Simulation * simPtr, double initialTime, double period):
     PeriodicEvent(initialTime,period),simPtr(simPtr)
@@ -16,6 +16,8 @@
 #include "EventQueue.hpp"
 #include <iterator>
 
+// Fraction of bites recorded in the EIR table (see Simulation::writeEIR)
+#define EIR_SAMPLING_PROBABILITY 0.001
 
 class Simulation;
 
@@ -37,6 +39,26 @@ private:
 	Simulation * simPtr;
 };
 
+//periodically remove expired allele immunity when immunity loss is lazy
+class ImmunitySweepEvent : public zppsim::PeriodicEvent
+{
+public:
+    ImmunitySweepEvent(Simulation * simPtr, double initialTime, double period);
+    virtual void performEvent(zppsim::EventQueue & queue);
+private:
+    Simulation * simPtr;
+};
+
+//periodically compact hosts' immune histories
+class ImmunityCompactionEvent : public zppsim::PeriodicEvent
+{
+public:
+    ImmunityCompactionEvent(Simulation * simPtr, double initialTime, double period);
+    virtual void performEvent(zppsim::EventQueue & queue);
+private:
+    Simulation * simPtr;
+};
+
 //add MDA events to simulate giving drugs to all hosts
 class MDAEvent : public zppsim::PeriodicEvent
 {
@@ -73,16 +95,58 @@ public:
 		if(genePtrVec.size() == 0) {
 			return 0;
 		}
-		size_t hashVal = _hash(genePtrVec[0]);
+		size_t hashVal = begin(genePtrVec[0]);
 		for(size_t i = 0; i < genePtrVec.size(); i++) {
-			hashVal ^= _hash(genePtrVec[i]) + 0x9e3779b9 + (hashVal << 6) + (hashVal >> 2);
+			hashVal = add(hashVal, genePtrVec[i]);
 		}
 		return hashVal;
 	}
+	
+	// Incremental form, for genes produced one at a time: begin with the
+	// first gene, then add every gene in order, including the first
+	size_t begin(GenePtr const & first) const
+	{
+		return _hash(first);
+	}
+	
+	size_t add(size_t hashVal, GenePtr const & genePtr) const
+	{
+		return hashVal ^ (_hash(genePtr) + 0x9e3779b9 + (hashVal << 6) + (hashVal >> 2));
+	}
 private:
 	std::hash<GenePtr> _hash;
 };
 
+/**
+	\brief Estimated memory held by simulation objects, by kind: object
+	counts and approximate bytes, including container overhead.
+	
+	Gathered by Simulation::measureMemoryFootprint.
+*/
+struct MemoryFootprint
+{
+	struct Entry
+	{
+		int64_t count = 0;
+		int64_t bytes = 0;
+	};
+	
+	Entry hosts;
+	Entry infections;
+	Entry infectionEvents;
+	Entry deathEvents;
+	Entry immuneHistories;
+	Entry immuneEntries;
+	Entry immunityLossEvents;
+	Entry genes;
+	Entry strains;
+	Entry strainMapKeys;
+	Entry spatialKernel;
+	
+	int64_t totalBytes();
+	void write(std::ostream & os);
+};
+
 class Simulation
 {
 friend class Population;
@@ -123,29 +187,42 @@ public:
 	std::vector<GenePtr> mutateStrain(StrainPtr & strain);
     std::vector<GenePtr> ectopicRecStrain(StrainPtr & strain);
 	StrainPtr recombineStrains(StrainPtr const & s1, StrainPtr const & s2);
+	static size_t sampleRecombinantGenes(
+		zppsim::rng_t & rng,
+		std::vector<GenePtr> const & genes1, std::vector<GenePtr> const & genes2,
+		std::vector<GenePtr> & daughterGenes
+	);
 	GenePtr generateRandomMicrosat();
     GenePtr storeMicrosat(std::vector<int64_t> Alleles);
     GenePtr recombineMS(GenePtr const & ms1, GenePtr const & ms2);
 	Host * drawDestinationHost(int64_t srcPopId);
+	int64_t drawDestinationPopulation(int64_t srcPopId);
+	void updateDestinationTables();
 	
 	void updateRates();
 	void sampleHosts();
+    void sweepImmunity();
+    void compactImmunity();
     void MDA();
     void IRS();
     void RemoveIRS();
     
-    void recordImmunity(Host & host, int64_t locusIndex, int64_t alleleId);
+    void recordImmunity(Host & host, AlleleKey key);
 	void recordTransmission(Host & srcHost, Host & dstHost, std::vector<StrainPtr> & strains);
-    void writeDuration(std::list<Infection>::iterator infectionItr);
+    void writeDuration(Infection & infection);
     void writeEIR(double time, int64_t infectious);
-    void writeFollowedHostInfection(std::list<Infection>::iterator infectionItr);
+    void countDeferredRateRefresh(int64_t nStartedInfections);
+    void insertEIRRow(double time, int64_t infectious);
+    void writeFollowedHostInfection(Infection & infection);
 	bool verifyState();
+	MemoryFootprint measureMemoryFootprint();
 private:
 	SimParameters * parPtr;
 	zppdb::Database * dbPtr;
 	zppsim::rng_t rng;
 	
 	DiscretizedDistribution hostLifetimeDist;
+	WithinHostRates withinHostRates;
 	
 	// MAIN EVENT QUEUE
 	std::unique_ptr<zppsim::EventQueue> queuePtr;
@@ -155,16 +232,55 @@ private:
     MDAEvent mdaEvent;
     IRSEvent irsEvent;
     RemoveIRSEvent removeirsEvent;
+    std::unique_ptr<ImmunitySweepEvent> immunitySweepEvent;
+    std::unique_ptr<ImmunityCompactionEvent> immunityCompactionEvent;
     int64_t mdaCounts = 0;
 	
 	int64_t nextHostId;
 	std::vector<std::unique_ptr<Population>> popPtrs;
 	
+	// Destination sampling for bites. nearKernel[src] holds fixed distance
+	// weights to the destinations sampled exactly (all populations for the
+	// dense kernel); with kernelCutoffDistance, farKernel[region] holds
+	// centroid-to-centroid weights to non-adjacent regions, and a far-field
+	// bite picks a region and then a population within it. Tables sample
+	// in proportion to kernel * biting rate * size, and are rebuilt whenever
+	// biting rates change.
+	struct KernelEntry
+	{
+		size_t index;
+		double weight;
+	};
+	std::vector<std::vector<KernelEntry>> nearKernel;
+	std::vector<AliasTable> nearTables;
+	std::vector<double> nearTotals;
+	std::vector<size_t> popRegions;
+	std::vector<std::vector<size_t>> regionMembers;
+	std::vector<std::vector<KernelEntry>> farKernel;
+	std::vector<AliasTable> farTables;
+	std::vector<double> farTotals;
+	std::vector<AliasTable> regionTables;
+	void initializeDistanceKernel();
+	void initializeSparseDistanceKernel(double cutoff);
+	
 	// Strain tracking: one strain object for each unique strain
 	int64_t nextStrainId;
 	std::vector<StrainPtr> strains;
 	std::unordered_map<StrainPtr, int64_t> strainPtrToIndexMap;
-	std::unordered_map<std::vector<GenePtr>, int64_t, HashGenePtrVec> geneVecToStrainIndexMap;
+	// Strain indices by hash of the (sorted) gene vector; strains with
+	// colliding hashes are told apart by comparing their genes
+	HashGenePtrVec hashGenePtrVec;
+	std::unordered_multimap<size_t, int64_t> strainHashToIndexMap;
+	StrainPtr getStrainSorted(std::vector<GenePtr> const & sortedGenes, size_t hashVal);
+	
+	// Scratch buffers reused by Host::transmitTo/transmitMSTo, recombineStrains,
+	// recombineMS and getStrain, so that a bite does not allocate
+	std::vector<StrainPtr> originalStrainsScratch;
+	std::vector<GenePtr> originalMSScratch;
+	std::vector<StrainPtr> transmittedStrainsScratch;
+	std::vector<GenePtr> transmittedMSScratch;
+	std::vector<GenePtr> strainGenesScratch;
+	std::vector<int64_t> msAllelesScratch;
 	
 	// Gene tracking
 	std::vector<GenePtr> genes;
@@ -174,7 +290,22 @@ private:
 	
     // Loci tracking
     size_t locusNumber = parPtr->genes.locusNumber;
+    
+    // whether allele immunity loss is applied lazily instead of via events
+    bool lazyImmunityLoss = parPtr->withinHost.useLazyImmunityLoss.present() && parPtr->withinHost.useLazyImmunityLoss;
+    
+    // whether biting events are only scheduled for infected sources
+    bool infectiousSourceBiting = parPtr->infectiousSourceBiting.present() && parPtr->infectiousSourceBiting;
+    
+    // whether hosts without infections or immunity are kept as bare records,
+    // with immune histories allocated on first gain and pooled on release
+    bool lazyHostState = parPtr->materializeHostsLazily.present() && parPtr->materializeHostsLazily;
+    
+    // whether populations keep counts of hosts immune to each allele
+    bool trackImmunityCoverage = parPtr->outputAlleleImmunityCoverage.present() && parPtr->outputAlleleImmunityCoverage;
     std::vector<int64_t> alleleNumber;
+    AlleleBitLayout alleleBitLayout;
+    void initializeAlleleBitLayout();
     
     // microsat tracking, if required
     // read microsat array from files generated by fastsimcoal
@@ -185,6 +316,11 @@ private:
     
 	int64_t transmissionCount;
     int64_t mutationCount;
+    
+    // Rate refreshes, and the event rate updates they would have made,
+    // skipped by batched immunity updates (Host::getSelectionMode)
+    int64_t deferredRateRefreshCount = 0;
+    int64_t deferredRateUpdateCount = 0;
 	
 	// Database tables
 	zppdb::Table<GeneRow> genesTable;
@@ -193,6 +329,8 @@ private:
 	zppdb::Table<HostRow> hostsTable;
     zppdb::Table<LociRow> microsatTable;
     zppdb::Table<AlleleImmunityRow> alleleImmunityTable;
+    zppdb::Table<AlleleImmunityCoverageRow> alleleImmunityCoverageTable;
+    zppdb::Table<AlleleImmunityOverlapRow> alleleImmunityOverlapTable;
 	
 	zppdb::Table<SampledHostRow> sampledHostsTable;
 	zppdb::Table<InfectionRow> sampledHostInfectionTable;
@@ -210,6 +348,7 @@ private:
 	
 	GenePtr createGene(std::vector<int64_t> Alleles,bool const functionality, int64_t const source);
 	GenePtr createMicrosat(std::vector<int64_t> Alleles);
+	static void addImmuneHistoryFootprint(ImmuneHistory & immHist, MemoryFootprint & fp);
     void runMSSimCoal(size_t msSampleSize);
 	void initializeDatabaseTables();
 };
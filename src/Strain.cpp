@@ -7,7 +7,7 @@ using namespace std;
 using namespace zppsim;
 
 Strain::Strain(int64_t id, std::vector<GenePtr> const & genes,bool writeToDatabase,Database & db, Table<StrainRow> & strainsTable) :
-	id(id), genes(genes),recorded(writeToDatabase)
+	id(narrowId(id, "strain")), recorded(writeToDatabase), genes(genes)
 {
     if (writeToDatabase) {
         StrainRow row;
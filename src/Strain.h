@@ -16,7 +16,7 @@ class Strain
 {
 friend class Simulation;
 public:
-	int64_t const id;
+	int32_t const id;
 	
 	Strain(int64_t id, std::vector<GenePtr> const & genes, bool writeToDatabase,Database & db, Table<StrainRow> & strainsTable);
 	int64_t size();
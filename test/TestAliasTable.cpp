@@ -0,0 +1,76 @@
+#include "catch.hpp"
+#include "DiscretizedDistribution.h"
+#include <cmath>
+#include <vector>
+
+using namespace std;
+
+// Draw frequencies from `nDraws` samples of a table built from `weights`
+static vector<double> drawFrequencies(vector<double> const & weights, int64_t nDraws, uint64_t seed)
+{
+	zppsim::rng_t rng(seed);
+	AliasTable table(weights);
+	vector<double> freqs(weights.size(), 0.0);
+	for(int64_t i = 0; i < nDraws; i++) {
+		size_t index = table.draw(rng);
+		REQUIRE(index < weights.size());
+		freqs[index] += 1.0;
+	}
+	for(auto & freq : freqs) {
+		freq /= nDraws;
+	}
+	return freqs;
+}
+
+// Frequencies should be within a few binomial standard errors of the
+// normalized weights
+static void checkFrequencies(vector<double> const & weights, vector<double> const & freqs, int64_t nDraws)
+{
+	double total = 0.0;
+	for(double w : weights) {
+		total += w;
+	}
+	for(size_t i = 0; i < weights.size(); i++) {
+		double p = weights[i] / total;
+		double sd = sqrt(p * (1.0 - p) / nDraws);
+		CHECK(fabs(freqs[i] - p) <= 5.0 * sd + 1e-12);
+	}
+}
+
+TEST_CASE("AliasTable reports its size")
+{
+	CHECK(AliasTable().size() == 0);
+	CHECK(AliasTable(vector<double>({ 1.0 })).size() == 1);
+	CHECK(AliasTable(vector<double>({ 1.0, 0.0, 3.0, 6.0, 0.5 })).size() == 5);
+	CHECK(AliasTable(vector<double>({ 0.0, 0.0, 0.0 })).size() == 3);
+}
+
+TEST_CASE("AliasTable draws in proportion to its weights")
+{
+	int64_t nDraws = 1000000;
+
+	vector<double> weights({ 1.0, 0.0, 3.0, 6.0, 0.5 });
+	vector<double> freqs = drawFrequencies(weights, nDraws, 1);
+	checkFrequencies(weights, freqs, nDraws);
+	CHECK(freqs[1] == 0.0);
+
+	// Widely spread weights exercise many small/large pairings
+	vector<double> spread;
+	for(int i = 0; i < 50; i++) {
+		spread.push_back(pow(1.3, i % 17) + (i % 5 == 0 ? 0.0 : 0.01));
+	}
+	checkFrequencies(spread, drawFrequencies(spread, nDraws, 2), nDraws);
+
+	// Equal weights, and a single entry
+	vector<double> equal(7, 2.5);
+	checkFrequencies(equal, drawFrequencies(equal, nDraws, 3), nDraws);
+	CHECK(drawFrequencies(vector<double>({ 4.0 }), 1000, 4)[0] == 1.0);
+}
+
+TEST_CASE("AliasTable falls back to uniform draws when all weights are zero")
+{
+	int64_t nDraws = 1000000;
+	vector<double> zeros(4, 0.0);
+	vector<double> freqs = drawFrequencies(zeros, nDraws, 5);
+	checkFrequencies(vector<double>(4, 1.0), freqs, nDraws);
+}
@@ -0,0 +1,62 @@
+#include "catch.hpp"
+#include "ImmuneHistory.h"
+#include <cstdint>
+#include <unordered_set>
+
+using namespace std;
+
+TEST_CASE("AlleleKey round-trips locus and allele at the field boundaries")
+{
+	int64_t maxLocus = (int64_t(1) << AlleleKey::LOCUS_BITS) - 1;
+	int64_t maxAllele = (int64_t(1) << AlleleKey::ALLELE_BITS) - 1;
+
+	int64_t loci[] = { 0, 1, 2, maxLocus - 1, maxLocus };
+	int64_t alleles[] = { 0, 1, 63, 64, maxAllele - 1, maxAllele };
+	for(int64_t locusId : loci) {
+		for(int64_t alleleId : alleles) {
+			AlleleKey key(locusId, alleleId);
+			CHECK(key.locusId() == locusId);
+			CHECK(key.alleleId() == alleleId);
+			CHECK(key == AlleleKey(locusId, alleleId));
+		}
+	}
+
+	// Fields do not bleed into each other
+	CHECK(AlleleKey(0, maxAllele) != AlleleKey(1, 0));
+	CHECK(AlleleKey(1, 0).packed == AlleleKey(0, maxAllele).packed + 1);
+	CHECK(AlleleKey(maxLocus, maxAllele).packed == UINT64_MAX);
+	CHECK(AlleleKey().locusId() == 0);
+	CHECK(AlleleKey().alleleId() == 0);
+}
+
+TEST_CASE("AlleleKey rejects out-of-range fields")
+{
+	int64_t locusLimit = int64_t(1) << AlleleKey::LOCUS_BITS;
+	int64_t alleleLimit = int64_t(1) << AlleleKey::ALLELE_BITS;
+
+	CHECK(AlleleKey::fits(0, 0));
+	CHECK(AlleleKey::fits(locusLimit - 1, alleleLimit - 1));
+	CHECK_FALSE(AlleleKey::fits(locusLimit, 0));
+	CHECK_FALSE(AlleleKey::fits(0, alleleLimit));
+	CHECK_FALSE(AlleleKey::fits(-1, 0));
+	CHECK_FALSE(AlleleKey::fits(0, -1));
+	
+	// Out-of-range fields throw rather than wrap into another key
+	CHECK_NOTHROW(AlleleKey(locusLimit - 1, alleleLimit - 1));
+	CHECK_THROWS(AlleleKey(locusLimit, 0));
+	CHECK_THROWS(AlleleKey(0, alleleLimit));
+	CHECK_THROWS(AlleleKey(-1, 0));
+	CHECK_THROWS(AlleleKey(0, -1));
+}
+
+TEST_CASE("HashAlleleKey separates neighbouring keys")
+{
+	HashAlleleKey hash;
+	unordered_set<size_t> hashes;
+	for(int64_t locusId = 0; locusId < 4; locusId++) {
+		for(int64_t alleleId = 0; alleleId < 256; alleleId++) {
+			hashes.insert(hash(AlleleKey(locusId, alleleId)));
+		}
+	}
+	CHECK(hashes.size() == 4 * 256);
+}
@@ -0,0 +1,102 @@
+#include "catch.hpp"
+#include "Infection.h"
+#include <vector>
+
+using namespace std;
+
+static Infection makeInfection(int32_t id)
+{
+	Infection infection;
+	infection.id = id;
+	return infection;
+}
+
+static vector<int32_t> infectionIds(InfectionStore & store)
+{
+	vector<int32_t> ids;
+	for(auto & infection : store) {
+		ids.push_back(infection.id);
+	}
+	return ids;
+}
+
+TEST_CASE("InfectionStore reuses the slot of an erased infection")
+{
+	InfectionStore store;
+	InfectionHandle h0 = store.insert(makeInfection(0));
+	InfectionHandle h1 = store.insert(makeInfection(1));
+	InfectionHandle h2 = store.insert(makeInfection(2));
+	REQUIRE(store.size() == 3);
+	CHECK(store.get(h1).id == 1);
+
+	store.erase(h1);
+	CHECK(store.size() == 2);
+	CHECK_FALSE(store.contains(h1));
+	CHECK(store.contains(h0));
+	CHECK(store.contains(h2));
+
+	InfectionHandle h3 = store.insert(makeInfection(3));
+	CHECK(h3.slot == h1.slot);
+	CHECK(h3.generation != h1.generation);
+	CHECK(store.size() == 3);
+	CHECK(store.get(h3).id == 3);
+	CHECK(store.get(h0).id == 0);
+	CHECK(store.get(h2).id == 2);
+}
+
+TEST_CASE("InfectionStore rejects stale handles after slot reuse")
+{
+	InfectionStore store;
+	InfectionHandle h0 = store.insert(makeInfection(0));
+	store.erase(h0);
+	InfectionHandle h1 = store.insert(makeInfection(1));
+	REQUIRE(h1.slot == h0.slot);
+
+	CHECK_FALSE(store.contains(h0));
+	CHECK(store.contains(h1));
+
+	// Clearing also invalidates every outstanding handle
+	store.clear();
+	CHECK(store.empty());
+	CHECK_FALSE(store.contains(h1));
+	InfectionHandle h2 = store.insert(makeInfection(2));
+	CHECK(h2.slot == h1.slot);
+	CHECK_FALSE(store.contains(h1));
+	CHECK(store.contains(h2));
+
+	// Handles beyond the slot array are not live either
+	CHECK_FALSE(store.contains(InfectionHandle { 5, 0 }));
+}
+
+TEST_CASE("InfectionStore iteration skips erased slots")
+{
+	InfectionStore store;
+	vector<InfectionHandle> handles;
+	for(int32_t id = 0; id < 6; id++) {
+		handles.push_back(store.insert(makeInfection(id)));
+	}
+
+	store.erase(handles[0]);
+	store.erase(handles[3]);
+	store.erase(handles[5]);
+	CHECK(infectionIds(store) == vector<int32_t>({ 1, 2, 4 }));
+	CHECK(store.size() == 3);
+
+	// erase(iterator) returns the next occupied slot
+	auto itr = store.begin();
+	REQUIRE(itr->id == 1);
+	itr = store.erase(itr);
+	REQUIRE(itr != store.end());
+	CHECK(itr->id == 2);
+	CHECK(infectionIds(store) == vector<int32_t>({ 2, 4 }));
+
+	// Iterator handles refer back to the same infections
+	for(auto itr = store.begin(); itr != store.end(); itr++) {
+		CHECK(store.get(itr.handle()).id == itr->id);
+	}
+
+	store.erase(handles[2]);
+	store.erase(handles[4]);
+	CHECK(store.empty());
+	CHECK(store.begin() == store.end());
+}
@@ -0,0 +1,190 @@
+#include "catch.hpp"
+#include "Simulation.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <map>
+#include <vector>
+
+using namespace std;
+
+// Genes that are never written to the database
+static vector<GenePtr> makeGenes(int64_t n)
+{
+	static zppdb::Database db(":memory:");
+	static zppdb::Table<GeneRow> genesTable("genes");
+	static zppdb::Table<LociRow> lociTable("loci");
+	vector<GenePtr> genes;
+	for(int64_t i = 0; i < n; i++) {
+		genes.emplace_back(new Gene(
+			i, 1.0, 0.0, 0, true, vector<int64_t>({ i }), false, false, db, genesTable, lociTable
+		));
+	}
+	return genes;
+}
+
+static vector<GenePtr> sorted(vector<GenePtr> genes)
+{
+	sort(genes.begin(), genes.end());
+	return genes;
+}
+
+// Number of copies of each gene across both parents
+static map<GenePtr, int64_t> poolCounts(vector<GenePtr> const & genes1, vector<GenePtr> const & genes2)
+{
+	map<GenePtr, int64_t> counts;
+	for(auto & genePtr : genes1) {
+		counts[genePtr]++;
+	}
+	for(auto & genePtr : genes2) {
+		counts[genePtr]++;
+	}
+	return counts;
+}
+
+TEST_CASE("Recombinant genes are a sorted subset of the parents with a matching hash")
+{
+	vector<GenePtr> genes = makeGenes(12);
+	// Parents share genes 3, 4 and 5
+	vector<GenePtr> genes1 = sorted(vector<GenePtr>(genes.begin(), genes.begin() + 6));
+	vector<GenePtr> genes2 = sorted(vector<GenePtr>(genes.begin() + 3, genes.begin() + 9));
+	map<GenePtr, int64_t> pool = poolCounts(genes1, genes2);
+
+	zppsim::rng_t rng(1);
+	HashGenePtrVec hash;
+	vector<GenePtr> daughterGenes;
+	for(int64_t i = 0; i < 10000; i++) {
+		size_t hashVal = Simulation::sampleRecombinantGenes(rng, genes1, genes2, daughterGenes);
+		REQUIRE(daughterGenes.size() == genes1.size());
+		CHECK(is_sorted(daughterGenes.begin(), daughterGenes.end()));
+		CHECK(hashVal == hash(daughterGenes));
+
+		map<GenePtr, int64_t> counts;
+		for(auto & genePtr : daughterGenes) {
+			counts[genePtr]++;
+		}
+		for(auto & kv : counts) {
+			REQUIRE(pool.find(kv.first) != pool.end());
+			CHECK(kv.second <= pool[kv.first]);
+		}
+	}
+}
+
+TEST_CASE("Recombinant genes include each parental copy with probability one half")
+{
+	vector<GenePtr> genes = makeGenes(10);
+	// Genes 2 and 3 are carried by both parents
+	vector<GenePtr> genes1 = sorted(vector<GenePtr>(genes.begin(), genes.begin() + 5));
+	vector<GenePtr> genes2 = sorted(vector<GenePtr>({ genes[2], genes[3], genes[5], genes[6], genes[7] }));
+	map<GenePtr, int64_t> pool = poolCounts(genes1, genes2);
+
+	zppsim::rng_t rng(2);
+	int64_t nDraws = 200000;
+	map<GenePtr, int64_t> totals;
+	vector<GenePtr> daughterGenes;
+	for(int64_t i = 0; i < nDraws; i++) {
+		Simulation::sampleRecombinantGenes(rng, genes1, genes2, daughterGenes);
+		for(auto & genePtr : daughterGenes) {
+			totals[genePtr]++;
+		}
+	}
+
+	// Each of the 10 pooled copies is kept with probability 5/10, so a gene
+	// is expected pool[gene] / 2 times per daughter
+	for(auto & kv : pool) {
+		double expected = kv.second * 0.5;
+		double mean = totals[kv.first] / double(nDraws);
+		double sd = sqrt(kv.second * 0.25 / nDraws);
+		CHECK(fabs(mean - expected) <= 5.0 * sd);
+	}
+}
+
+TEST_CASE("Recombinant gene subsets are uniformly distributed")
+{
+	vector<GenePtr> genes = makeGenes(4);
+	vector<GenePtr> genes1 = sorted(vector<GenePtr>({ genes[0], genes[1] }));
+	vector<GenePtr> genes2 = sorted(vector<GenePtr>({ genes[2], genes[3] }));
+
+	// All C(4, 2) = 6 subsets should be equally likely
+	zppsim::rng_t rng(3);
+	int64_t nDraws = 600000;
+	map<vector<GenePtr>, int64_t> subsetCounts;
+	vector<GenePtr> daughterGenes;
+	for(int64_t i = 0; i < nDraws; i++) {
+		Simulation::sampleRecombinantGenes(rng, genes1, genes2, daughterGenes);
+		subsetCounts[daughterGenes]++;
+	}
+	REQUIRE(subsetCounts.size() == 6);
+	double p = 1.0 / 6.0;
+	double sd = sqrt(p * (1.0 - p) / nDraws);
+	for(auto & kv : subsetCounts) {
+		CHECK(fabs(kv.second / double(nDraws) - p) <= 5.0 * sd);
+	}
+}
+
+TEST_CASE("Recombining a strain with itself draws from its doubled genes")
+{
+	vector<GenePtr> genes = sorted(makeGenes(6));
+	zppsim::rng_t rng(4);
+	vector<GenePtr> daughterGenes;
+	for(int64_t i = 0; i < 1000; i++) {
+		Simulation::sampleRecombinantGenes(rng, genes, genes, daughterGenes);
+		REQUIRE(daughterGenes.size() == genes.size());
+		CHECK(is_sorted(daughterGenes.begin(), daughterGenes.end()));
+		map<GenePtr, int64_t> counts;
+		for(auto & genePtr : daughterGenes) {
+			counts[genePtr]++;
+		}
+		for(auto & kv : counts) {
+			CHECK(kv.second <= 2);
+		}
+	}
+}
+
+// The gene vector hash as originally written, in one pass
+static size_t referenceHash(vector<GenePtr> const & genePtrVec)
+{
+	std::hash<GenePtr> hash;
+	if(genePtrVec.size() == 0) {
+		return 0;
+	}
+	size_t hashVal = hash(genePtrVec[0]);
+	for(size_t i = 0; i < genePtrVec.size(); i++) {
+		hashVal ^= hash(genePtrVec[i]) + 0x9e3779b9 + (hashVal << 6) + (hashVal >> 2);
+	}
+	return hashVal;
+}
+
+TEST_CASE("Incremental gene vector hash matches the one-pass hash")
+{
+	vector<GenePtr> genes = makeGenes(8);
+	HashGenePtrVec hash;
+	CHECK(hash(vector<GenePtr>()) == 0);
+	for(size_t n = 1; n <= genes.size(); n++) {
+		vector<GenePtr> prefix(genes.begin(), genes.begin() + n);
+		size_t hashVal = hash.begin(prefix[0]);
+		for(auto & genePtr : prefix) {
+			hashVal = hash.add(hashVal, genePtr);
+		}
+		CHECK(hashVal == referenceHash(prefix));
+		CHECK(hash(prefix) == referenceHash(prefix));
+	}
+	
+	// Repeated genes, as when parents share genes
+	vector<GenePtr> repeated({ genes[1], genes[1], genes[4] });
+	size_t hashVal = hash.begin(repeated[0]);
+	for(auto & genePtr : repeated) {
+		hashVal = hash.add(hashVal, genePtr);
+	}
+	CHECK(hashVal == referenceHash(repeated));
+	
+	// Sampled daughters hash the same way
+	vector<GenePtr> genes1 = sorted(vector<GenePtr>(genes.begin(), genes.begin() + 4));
+	vector<GenePtr> genes2 = sorted(vector<GenePtr>(genes.begin() + 2, genes.begin() + 6));
+	zppsim::rng_t rng(5);
+	vector<GenePtr> daughterGenes;
+	for(int64_t i = 0; i < 1000; i++) {
+		size_t daughterHash = Simulation::sampleRecombinantGenes(rng, genes1, genes2, daughterGenes);
+		CHECK(daughterHash == referenceHash(daughterGenes));
+	}
+}